@@ -0,0 +1,125 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#include "../include/OOBase/AsyncResponse.h"
+#include "../include/OOBase/Thread.h"
+
+#include "Bench.h"
+
+#include <stdlib.h>
+
+namespace
+{
+	struct Target
+	{
+		bool on_response(OOBase::CDRStream&)
+		{
+			return true;
+		}
+	};
+
+	template <typename Dispatcher>
+	struct Context
+	{
+		Dispatcher              m_dispatcher;
+		Target                  m_target;
+		size_t                  m_iterations;
+		size_t                  m_threads;
+		OOBase::Atomic<size_t>  m_ready;
+		OOBase::Atomic<size_t>  m_failures;
+
+		Context(size_t iterations, size_t threads) :
+				m_iterations(iterations),
+				m_threads(threads),
+				m_ready(0),
+				m_failures(0)
+		{}
+
+		static int thread_fn(void* param)
+		{
+			Context* pThis = static_cast<Context*>(param);
+
+			OOBase::CDRStream stream(64);
+
+			// Start everyone together
+			++pThis->m_ready;
+			while (pThis->m_ready != pThis->m_threads)
+				OOBase::Thread::yield();
+
+			for (size_t i = 0; i < pThis->m_iterations; ++i)
+			{
+				OOBase::uint32_t handle = 0;
+				if (!pThis->m_dispatcher.add_response(&pThis->m_target,&Target::on_response,handle))
+				{
+					++pThis->m_failures;
+					continue;
+				}
+
+				stream.reset();
+				stream.write(handle);
+
+				if (!pThis->m_dispatcher.handle_response(stream))
+					++pThis->m_failures;
+			}
+			return 0;
+		}
+	};
+
+	template <size_t Shards>
+	void run(const char* variant, size_t threads, size_t iterations)
+	{
+		typedef OOBase::AsyncResponseDispatcher<OOBase::uint32_t,OOBase::CrtAllocator,Shards> dispatcher_t;
+
+		Context<dispatcher_t> ctx(iterations,threads);
+
+		OOBase::ThreadPool pool;
+
+		OOBase::uint64_t start = Bench::now_nsecs();
+		int err = pool.run(&Context<dispatcher_t>::thread_fn,&ctx,threads);
+		if (err)
+		{
+			fprintf(stderr,"Failed to start threads: %d\n",err);
+			exit(EXIT_FAILURE);
+		}
+		pool.join();
+		OOBase::uint64_t elapsed = Bench::now_nsecs() - start;
+
+		if (ctx.m_failures != 0)
+			fprintf(stderr,"%s: %lu failed operations\n",variant,static_cast<unsigned long>(static_cast<size_t>(ctx.m_failures)));
+
+		Bench::report("async_response",variant,threads,static_cast<OOBase::uint64_t>(threads) * iterations,elapsed);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t max_threads = (argc > 1 ? strtoul(argv[1],NULL,10) : 8);
+	size_t iterations = (argc > 2 ? strtoul(argv[2],NULL,10) : 1000000);
+
+	for (size_t threads = 1; threads <= max_threads; threads *= 2)
+	{
+		run<1>("single",threads,iterations);
+		run<16>("sharded16",threads,iterations);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef OOBASE_BENCH_H_INCLUDED_
+#define OOBASE_BENCH_H_INCLUDED_
+
+#include "../include/OOBase/Memory.h"
+#include "../include/OOBase/Atomic.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace Bench
+{
+	/// Monotonic clock in nanoseconds
+	inline OOBase::uint64_t now_nsecs()
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER freq, now;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&now);
+		return static_cast<OOBase::uint64_t>(now.QuadPart / freq.QuadPart) * 1000000000ULL + static_cast<OOBase::uint64_t>(now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		return static_cast<OOBase::uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#endif
+	}
+
+	/// Print a single result as one JSON object per line
+	inline void report(const char* bench, const char* variant, size_t threads, OOBase::uint64_t ops, OOBase::uint64_t nsecs)
+	{
+		double secs = static_cast<double>(nsecs) / 1e9;
+		printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"threads\":%lu,\"ops\":%llu,\"secs\":%.6f,\"ops_per_sec\":%.0f,\"ns_per_op\":%.2f}\n",
+				bench,variant,static_cast<unsigned long>(threads),static_cast<unsigned long long>(ops),secs,
+				secs > 0 ? ops / secs : 0.0,
+				ops ? static_cast<double>(nsecs) / ops : 0.0);
+		fflush(stdout);
+	}
+
+	/// Print a result that moved a known number of bytes as one JSON object per line
+	inline void report_bytes(const char* bench, const char* variant, OOBase::uint64_t ops, OOBase::uint64_t bytes, OOBase::uint64_t nsecs)
+	{
+		double secs = static_cast<double>(nsecs) / 1e9;
+		printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"ops\":%llu,\"bytes\":%llu,\"secs\":%.6f,\"ns_per_op\":%.2f,\"bytes_per_sec\":%.0f}\n",
+				bench,variant,static_cast<unsigned long long>(ops),static_cast<unsigned long long>(bytes),secs,
+				ops ? static_cast<double>(nsecs) / ops : 0.0,
+				secs > 0 ? bytes / secs : 0.0);
+		fflush(stdout);
+	}
+
+	/// A fixed capacity set of latency samples, safe to add() to from multiple threads
+	class Samples : public OOBase::NonCopyable
+	{
+	public:
+		explicit Samples(size_t capacity) :
+				m_samples(static_cast<OOBase::uint64_t*>(OOBase::CrtAllocator::allocate(capacity * sizeof(OOBase::uint64_t),OOBase::alignment_of<OOBase::uint64_t>::value))),
+				m_capacity(m_samples ? capacity : 0),
+				m_next(0)
+		{}
+
+		~Samples()
+		{
+			OOBase::CrtAllocator::free(m_samples);
+		}
+
+		void add(OOBase::uint64_t nsecs)
+		{
+			size_t i = m_next++;
+			if (i < m_capacity)
+				m_samples[i] = nsecs;
+		}
+
+		size_t count() const
+		{
+			size_t n = m_next;
+			return n < m_capacity ? n : m_capacity;
+		}
+
+		/// Sort the samples, call once all adds are complete
+		void sort()
+		{
+			qsort(m_samples,count(),sizeof(OOBase::uint64_t),&compare);
+		}
+
+		/// Valid only after sort(), per_mille is in the range [0,1000]
+		OOBase::uint64_t percentile(unsigned int per_mille) const
+		{
+			size_t n = count();
+			if (!n)
+				return 0;
+
+			size_t i = (n * per_mille) / 1000;
+			return m_samples[i < n ? i : n - 1];
+		}
+
+	private:
+		OOBase::uint64_t*      m_samples;
+		size_t                 m_capacity;
+		OOBase::Atomic<size_t> m_next;
+
+		static int compare(const void* p1, const void* p2)
+		{
+			OOBase::uint64_t v1 = *static_cast<const OOBase::uint64_t*>(p1);
+			OOBase::uint64_t v2 = *static_cast<const OOBase::uint64_t*>(p2);
+			return (v1 < v2 ? -1 : (v1 > v2 ? 1 : 0));
+		}
+	};
+
+	/// Print a throughput and latency result as one JSON object per line
+	inline void report_latency(const char* bench, const char* variant, size_t conns, OOBase::uint64_t ops, OOBase::uint64_t nsecs, Samples& samples)
+	{
+		samples.sort();
+
+		double secs = static_cast<double>(nsecs) / 1e9;
+		printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"conns\":%lu,\"ops\":%llu,\"secs\":%.6f,\"ops_per_sec\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+				bench,variant,static_cast<unsigned long>(conns),static_cast<unsigned long long>(ops),secs,
+				secs > 0 ? ops / secs : 0.0,
+				static_cast<unsigned long long>(samples.percentile(500)),
+				static_cast<unsigned long long>(samples.percentile(990)),
+				static_cast<unsigned long long>(samples.percentile(999)),
+				static_cast<unsigned long long>(samples.percentile(1000)));
+		fflush(stdout);
+	}
+}
+
+#endif // OOBASE_BENCH_H_INCLUDED_
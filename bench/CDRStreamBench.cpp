@@ -0,0 +1,235 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+
+#include "../include/OOBase/CDRStream.h"
+
+#include "Bench.h"
+
+#include <string.h>
+
+namespace
+{
+	/// Minimal target for CDRStream::read_string() that reuses its storage, so the allocator is not measured
+	class BenchString
+	{
+	public:
+		BenchString() : m_len(0)
+		{}
+
+		void clear()
+		{
+			m_len = 0;
+		}
+
+		bool assign(const char* sz, size_t len)
+		{
+			if (len > sizeof(m_data))
+				return false;
+
+			memcpy(m_data,sz,len);
+			m_len = len;
+			return true;
+		}
+
+		size_t length() const
+		{
+			return m_len;
+		}
+
+	private:
+		char   m_data[256];
+		size_t m_len;
+	};
+
+	/// Lots of small fixed-size integers, the typical RPC header and argument mix
+	struct SmallInts
+	{
+		static const char* name() { return "small_ints"; }
+
+		static bool encode(OOBase::CDRStream& stream)
+		{
+			for (OOBase::uint32_t i = 0; i < 16; ++i)
+			{
+				if (!stream.write(static_cast<OOBase::uint8_t>(i)) ||
+						!stream.write(static_cast<OOBase::uint16_t>(i * 3)) ||
+						!stream.write(i * 0x01010101) ||
+						!stream.write(static_cast<OOBase::uint64_t>(i) << 40) ||
+						!stream.write(i & 1 ? true : false))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		static bool decode(OOBase::CDRStream& stream, OOBase::uint64_t& sum)
+		{
+			for (size_t i = 0; i < 16; ++i)
+			{
+				OOBase::uint8_t v8 = 0;
+				OOBase::uint16_t v16 = 0;
+				OOBase::uint32_t v32 = 0;
+				OOBase::uint64_t v64 = 0;
+				bool b = false;
+				if (!stream.read(v8) || !stream.read(v16) || !stream.read(v32) || !stream.read(v64) || !stream.read(b))
+					return false;
+
+				sum += v8 + v16 + v32 + v64 + b;
+			}
+			return true;
+		}
+	};
+
+	/// Short strings, each carrying a variable length prefix
+	struct Strings
+	{
+		static const char* name() { return "strings"; }
+
+		static bool encode(OOBase::CDRStream& stream)
+		{
+			static const char* const s_strings[4] =
+			{
+				"org.omegaonline.object",
+				"method",
+				"a rather longer string that spills past one cache line of payload, to be realistic",
+				""
+			};
+
+			for (size_t i = 0; i < 16; ++i)
+			{
+				if (!stream.write(s_strings[i & 3]))
+					return false;
+			}
+			return true;
+		}
+
+		static bool decode(OOBase::CDRStream& stream, OOBase::uint64_t& sum)
+		{
+			BenchString str;
+			for (size_t i = 0; i < 16; ++i)
+			{
+				if (!stream.read_string(str))
+					return false;
+
+				sum += str.length();
+			}
+			return true;
+		}
+	};
+
+	/// A single large opaque payload
+	struct Blob
+	{
+		static const size_t Size = 64 * 1024;
+
+		static const char* name() { return "blob64k"; }
+
+		static const OOBase::uint8_t* data()
+		{
+			static OOBase::uint8_t s_data[Size] = {0};
+			return s_data;
+		}
+
+		static bool encode(OOBase::CDRStream& stream)
+		{
+			return stream.write(static_cast<OOBase::uint32_t>(Size)) && stream.write_bytes(data(),Size);
+		}
+
+		static bool decode(OOBase::CDRStream& stream, OOBase::uint64_t& sum)
+		{
+			static OOBase::uint8_t s_dest[Size];
+
+			OOBase::uint32_t len = 0;
+			if (!stream.read(len) || len > Size || stream.read_bytes(s_dest,len) != len)
+				return false;
+
+			sum += s_dest[len / 2];
+			return true;
+		}
+	};
+
+	template <typename Shape>
+	void run(bool swapped, size_t iterations)
+	{
+		// Mixed endianness means the sender's byte order is not ours, so every value is swapped
+		OOBase::uint16_t endianess = OOBASE_BYTE_ORDER;
+		if (swapped)
+			endianess = (OOBASE_BYTE_ORDER == OOBASE_LITTLE_ENDIAN ? OOBASE_BIG_ENDIAN : OOBASE_LITTLE_ENDIAN);
+
+		char variant[64] = {0};
+		snprintf(variant,sizeof(variant),"%s%s",Shape::name(),swapped ? "_swapped" : "");
+
+		OOBase::CDRStream stream(1024);
+		stream.endianess(endianess);
+
+		// Encode
+		OOBase::uint64_t bytes = 0;
+		OOBase::uint64_t start = Bench::now_nsecs();
+		for (size_t i = 0; i < iterations; ++i)
+		{
+			stream.reset();
+			if (!stream.write_endianess() || !Shape::encode(stream))
+			{
+				fprintf(stderr,"%s: encode failed: %d\n",variant,stream.last_error());
+				return;
+			}
+			bytes += stream.length();
+		}
+		Bench::report_bytes("cdr_encode",variant,iterations,bytes,Bench::now_nsecs() - start);
+
+		// Decode the last encoded message repeatedly
+		OOBase::uint64_t sum = 0;
+		bytes = 0;
+		start = Bench::now_nsecs();
+		for (size_t i = 0; i < iterations; ++i)
+		{
+			stream.buffer()->mark_rd_ptr(0);
+			bytes += stream.length();
+
+			if (!stream.read_endianess() || !Shape::decode(stream,sum))
+			{
+				fprintf(stderr,"%s: decode failed: %d\n",variant,stream.last_error());
+				return;
+			}
+		}
+		Bench::report_bytes("cdr_decode",variant,iterations,bytes,Bench::now_nsecs() - start);
+
+		// Keep the compiler from discarding the reads
+		if (sum == 0x5a5a5a5a5a5a5a5aULL)
+			fprintf(stderr,"%s: unlikely checksum\n",variant);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t iterations = (argc > 1 ? strtoul(argv[1],NULL,10) : 1000000);
+
+	for (int swapped = 0; swapped < 2; ++swapped)
+	{
+		run<SmallInts>(swapped != 0,iterations);
+		run<Strings>(swapped != 0,iterations);
+		run<Blob>(swapped != 0,iterations / 100 + 1);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,629 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+
+#include "../include/OOBase/Proactor.h"
+#include "../include/OOBase/Thread.h"
+
+#include "Bench.h"
+
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct Options
+	{
+		size_t         m_messages;  ///< Round trips per active client
+		size_t         m_msg_size;  ///< Echo payload size in bytes
+		size_t         m_clients;   ///< Maximum number of active clients
+		size_t         m_idle;      ///< Idle connections in the mixed run
+		size_t         m_connects;  ///< Connections per thread in the accept storm
+		unsigned short m_port;      ///< Loopback TCP port
+		const char*    m_path;      ///< Unix socket path
+	};
+
+	/// Where to listen and connect: loopback TCP or a local socket path
+	struct Endpoint
+	{
+		bool        m_local;
+		sockaddr_in m_addr;
+		const char* m_path;
+
+		// Small echoes would otherwise measure Nagle's algorithm
+		OOBase::SocketOptions m_options;
+
+		Endpoint(unsigned short port) : m_local(false), m_path(NULL)
+		{
+			memset(&m_addr,0,sizeof(m_addr));
+			m_addr.sin_family = AF_INET;
+			m_addr.sin_port = htons(port);
+			m_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			memset(&m_options,0,sizeof(m_options));
+			m_options.m_nodelay = OOBase::SocketOptions::eOn;
+		}
+
+		Endpoint(const char* path) : m_local(true), m_path(path)
+		{
+			memset(&m_addr,0,sizeof(m_addr));
+			memset(&m_options,0,sizeof(m_options));
+		}
+
+		OOBase::AsyncSocket* connect(OOBase::Proactor* proactor, int& err) const
+		{
+			if (m_local)
+				return proactor->connect(m_path,err,OOBase::Timeout());
+
+			return proactor->connect(reinterpret_cast<const sockaddr*>(&m_addr),sizeof(m_addr),err,OOBase::Timeout(),&m_options);
+		}
+	};
+
+	/// The server side, echoes every message back to the sender on the Proactor thread
+	class EchoServer
+	{
+	public:
+		EchoServer(OOBase::Proactor* proactor, size_t msg_size) :
+				m_proactor(proactor),
+				m_msg_size(msg_size),
+				m_accepted(0),
+				m_live(0)
+		{}
+
+		int listen(const Endpoint& ep)
+		{
+			int err = 0;
+			if (ep.m_local)
+				m_acceptor = m_proactor->accept(this,&on_accept_local,ep.m_path,err);
+			else
+				m_acceptor = m_proactor->accept(this,&on_accept,reinterpret_cast<const sockaddr*>(&ep.m_addr),sizeof(ep.m_addr),err,&ep.m_options);
+			return err;
+		}
+
+		void close()
+		{
+			m_acceptor = NULL;
+		}
+
+		/// Wait for the server side of every connection to notice its client has gone
+		void drain()
+		{
+			OOBase::uint64_t give_up = Bench::now_nsecs() + 5000000000ULL;
+			while (m_live != 0 && Bench::now_nsecs() < give_up)
+				OOBase::Thread::yield();
+		}
+
+		size_t accepted() const
+		{
+			return m_accepted;
+		}
+
+	private:
+		class Connection
+		{
+		public:
+			Connection(EchoServer* server, OOBase::AsyncSocket* pSocket) :
+					m_server(server),
+					m_socket(pSocket)
+			{
+				++m_server->m_live;
+			}
+
+			~Connection()
+			{
+				--m_server->m_live;
+			}
+
+			int start()
+			{
+				if (!m_buffer)
+				{
+					m_buffer = OOBase::Buffer::create(m_server->m_msg_size);
+					if (!m_buffer)
+						return ERROR_OUTOFMEMORY;
+				}
+
+				m_buffer->reset();
+				return m_socket->recv(this,&Connection::on_recv,m_buffer,m_server->m_msg_size);
+			}
+
+		private:
+			EchoServer*                         m_server;
+			OOBase::RefPtr<OOBase::AsyncSocket> m_socket;
+			OOBase::RefPtr<OOBase::Buffer>      m_buffer;
+
+			void on_recv(const OOBase::RefPtr<OOBase::Buffer>& buffer, int err)
+			{
+				// A short read means the client has closed
+				if (err || buffer->length() < m_server->m_msg_size || m_socket->send(this,&Connection::on_sent,buffer) != 0)
+					OOBase::CrtAllocator::delete_free(this);
+			}
+
+			void on_sent(const OOBase::RefPtr<OOBase::Buffer>&, int err)
+			{
+				if (err || start() != 0)
+					OOBase::CrtAllocator::delete_free(this);
+			}
+		};
+
+		OOBase::Proactor*                m_proactor;
+		size_t                           m_msg_size;
+		OOBase::RefPtr<OOBase::Acceptor> m_acceptor;
+		OOBase::Atomic<size_t>           m_accepted;
+		OOBase::Atomic<size_t>           m_live;
+
+		void accepted(OOBase::AsyncSocket* pSocket, int err)
+		{
+			if (err)
+			{
+				fprintf(stderr,"Accept failed: %d\n",err);
+				return;
+			}
+
+			++m_accepted;
+
+			// A zero message size means accept and drop
+			if (!m_msg_size)
+			{
+				pSocket->release();
+				return;
+			}
+
+			Connection* conn = NULL;
+			if (!OOBase::CrtAllocator::allocate_new(conn,this,pSocket))
+				pSocket->release();
+			else if (conn->start() != 0)
+				OOBase::CrtAllocator::delete_free(conn);
+		}
+
+		static void on_accept(void* param, OOBase::AsyncSocket* pSocket, const sockaddr*, socklen_t, int err)
+		{
+			static_cast<EchoServer*>(param)->accepted(pSocket,err);
+		}
+
+		static void on_accept_local(void* param, OOBase::AsyncSocket* pSocket, int err)
+		{
+			static_cast<EchoServer*>(param)->accepted(pSocket,err);
+		}
+	};
+
+	/// Runs a Proactor on a background thread for the lifetime of the object
+	class LoopThread
+	{
+	public:
+		LoopThread(OOBase::Proactor* proactor) : m_proactor(proactor)
+		{}
+
+		~LoopThread()
+		{
+			m_proactor->stop();
+			m_pool.join();
+		}
+
+		int start()
+		{
+			return m_pool.run(&run,m_proactor,1);
+		}
+
+	private:
+		OOBase::Proactor*  m_proactor;
+		OOBase::ThreadPool m_pool;
+
+		static int run(void* param)
+		{
+			int err = 0;
+			static_cast<OOBase::Proactor*>(param)->run(err);
+			return err;
+		}
+	};
+
+	/// Shared state for one set of ping-pong clients
+	struct EchoClients
+	{
+		OOBase::Proactor*      m_proactor;
+		const Endpoint*        m_endpoint;
+		const Options*         m_options;
+		size_t                 m_threads;
+		Bench::Samples         m_samples;
+		OOBase::Atomic<size_t> m_ready;
+		OOBase::Atomic<size_t> m_failures;
+
+		EchoClients(OOBase::Proactor* proactor, const Endpoint& ep, const Options& options, size_t threads) :
+				m_proactor(proactor),
+				m_endpoint(&ep),
+				m_options(&options),
+				m_threads(threads),
+				m_samples(threads * options.m_messages),
+				m_ready(0),
+				m_failures(0)
+		{}
+
+		static int thread_fn(void* param)
+		{
+			EchoClients* pThis = static_cast<EchoClients*>(param);
+
+			int err = 0;
+			OOBase::RefPtr<OOBase::AsyncSocket> ptrSocket = pThis->m_endpoint->connect(pThis->m_proactor,err);
+			OOBase::RefPtr<OOBase::Buffer> buffer = OOBase::Buffer::create(pThis->m_options->m_msg_size);
+			if (!err && !buffer)
+				err = ERROR_OUTOFMEMORY;
+
+			// Start everyone together, even on failure
+			++pThis->m_ready;
+			while (pThis->m_ready != pThis->m_threads)
+				OOBase::Thread::yield();
+
+			if (err)
+			{
+				++pThis->m_failures;
+				return err;
+			}
+
+			memset(buffer->wr_ptr(),0xa5,pThis->m_options->m_msg_size);
+
+			for (size_t i = 0; !err && i < pThis->m_options->m_messages; ++i)
+			{
+				buffer->reset();
+				buffer->wr_ptr(pThis->m_options->m_msg_size);
+
+				OOBase::uint64_t start = Bench::now_nsecs();
+
+				err = ptrSocket->send(buffer);
+				if (!err)
+				{
+					buffer->reset();
+					err = ptrSocket->recv(buffer,pThis->m_options->m_msg_size);
+				}
+
+				if (!err)
+					pThis->m_samples.add(Bench::now_nsecs() - start);
+			}
+
+			if (err)
+				++pThis->m_failures;
+
+			return err;
+		}
+	};
+
+	int run_echo(const char* bench, const char* variant, const Endpoint& ep, const Options& options, size_t clients, size_t idle)
+	{
+		int err = 0;
+		OOBase::Proactor* proactor = OOBase::Proactor::create(err);
+		if (err)
+			return err;
+
+		{
+			EchoServer server(proactor,options.m_msg_size);
+			err = server.listen(ep);
+			if (!err)
+			{
+				LoopThread loop(proactor);
+				err = loop.start();
+				if (!err)
+				{
+					// Idle connections are held open, but never send anything
+					OOBase::Vector<OOBase::AsyncSocket*> idle_sockets;
+					for (size_t i = 0; !err && i < idle; ++i)
+					{
+						OOBase::AsyncSocket* pSocket = ep.connect(proactor,err);
+						if (!err && (err = idle_sockets.push_back(pSocket)) != 0)
+							pSocket->release();
+					}
+
+					if (!err)
+					{
+						EchoClients ctx(proactor,ep,options,clients);
+						OOBase::ThreadPool pool;
+
+						OOBase::uint64_t start = Bench::now_nsecs();
+						err = pool.run(&EchoClients::thread_fn,&ctx,clients);
+						if (!err)
+						{
+							pool.join();
+							OOBase::uint64_t elapsed = Bench::now_nsecs() - start;
+
+							if (ctx.m_failures != 0)
+								fprintf(stderr,"%s/%s: %lu clients failed\n",bench,variant,static_cast<unsigned long>(static_cast<size_t>(ctx.m_failures)));
+
+							Bench::report_latency(bench,variant,clients + idle,ctx.m_samples.count(),elapsed,ctx.m_samples);
+						}
+					}
+
+					for (size_t i = 0; i < idle_sockets.size(); ++i)
+						(*idle_sockets.at(i))->release();
+
+					server.close();
+					server.drain();
+				}
+			}
+		}
+
+		OOBase::Proactor::destroy(proactor);
+		return err;
+	}
+
+	/// Many threads connecting at once, the server accepts and drops
+	struct AcceptStorm
+	{
+		OOBase::Proactor*      m_proactor;
+		const Endpoint*        m_endpoint;
+		size_t                 m_connects;
+		size_t                 m_threads;
+		Bench::Samples         m_samples;
+		OOBase::Atomic<size_t> m_ready;
+		OOBase::Atomic<size_t> m_failures;
+
+		AcceptStorm(OOBase::Proactor* proactor, const Endpoint& ep, size_t connects, size_t threads) :
+				m_proactor(proactor),
+				m_endpoint(&ep),
+				m_connects(connects),
+				m_threads(threads),
+				m_samples(connects * threads),
+				m_ready(0),
+				m_failures(0)
+		{}
+
+		static int thread_fn(void* param)
+		{
+			AcceptStorm* pThis = static_cast<AcceptStorm*>(param);
+
+			++pThis->m_ready;
+			while (pThis->m_ready != pThis->m_threads)
+				OOBase::Thread::yield();
+
+			for (size_t i = 0; i < pThis->m_connects; ++i)
+			{
+				OOBase::uint64_t start = Bench::now_nsecs();
+
+				int err = 0;
+				OOBase::AsyncSocket* pSocket = pThis->m_endpoint->connect(pThis->m_proactor,err);
+				if (err)
+				{
+					++pThis->m_failures;
+					continue;
+				}
+
+				pThis->m_samples.add(Bench::now_nsecs() - start);
+				pSocket->release();
+			}
+			return 0;
+		}
+	};
+
+	int run_accept_storm(const char* variant, const Endpoint& ep, const Options& options, size_t threads)
+	{
+		int err = 0;
+		OOBase::Proactor* proactor = OOBase::Proactor::create(err);
+		if (err)
+			return err;
+
+		{
+			EchoServer server(proactor,0);
+			err = server.listen(ep);
+			if (!err)
+			{
+				LoopThread loop(proactor);
+				err = loop.start();
+				if (!err)
+				{
+					AcceptStorm ctx(proactor,ep,options.m_connects,threads);
+					OOBase::ThreadPool pool;
+
+					OOBase::uint64_t start = Bench::now_nsecs();
+					err = pool.run(&AcceptStorm::thread_fn,&ctx,threads);
+					if (!err)
+					{
+						pool.join();
+
+						// Wait for the server to catch up
+						OOBase::uint64_t give_up = Bench::now_nsecs() + 5000000000ULL;
+						while (server.accepted() + ctx.m_failures < threads * options.m_connects && Bench::now_nsecs() < give_up)
+							OOBase::Thread::yield();
+
+						OOBase::uint64_t elapsed = Bench::now_nsecs() - start;
+
+						if (ctx.m_failures != 0)
+							fprintf(stderr,"accept_storm/%s: %lu connects failed\n",variant,static_cast<unsigned long>(static_cast<size_t>(ctx.m_failures)));
+
+						Bench::report_latency("accept_storm",variant,threads,server.accepted(),elapsed,ctx.m_samples);
+					}
+
+					server.close();
+				}
+			}
+		}
+
+		OOBase::Proactor::destroy(proactor);
+		return err;
+	}
+
+#if !defined(_WIN32)
+	// The Win32 Proactor has no timers
+
+	/// Timers re-armed from their own callbacks with varying short timeouts, measuring lateness
+	class TimerChurn
+	{
+	public:
+		TimerChurn(OOBase::Proactor* proactor, size_t fires) :
+				m_proactor(proactor),
+				m_fires(fires),
+				m_fired(0),
+				m_samples(fires)
+		{}
+
+		int run(size_t timers)
+		{
+			OOBase::Vector<Slot> slots;
+			int err = 0;
+			for (size_t i = 0; !err && i < timers; ++i)
+			{
+				Slot slot = { this, 0, i };
+				err = slots.push_back(slot);
+			}
+
+			// Every slot is pushed before any pointer is taken, so none move
+			for (size_t i = 0; !err && i < slots.size(); ++i)
+			{
+				Slot* slot = slots.at(i);
+				unsigned int delay = next_delay(slot);
+				slot->m_due = Bench::now_nsecs() + delay * 1000;
+				err = m_proactor->start_timer(slot,&on_timer,OOBase::Timeout(0,delay));
+			}
+
+			if (!err)
+			{
+				OOBase::uint64_t start = Bench::now_nsecs();
+				int ret = m_proactor->run(err);
+				if (ret != -1)
+				{
+					char variant[32] = {0};
+					snprintf(variant,sizeof(variant),"timers%lu",static_cast<unsigned long>(timers));
+					Bench::report_latency("timer_churn",variant,timers,m_fired,Bench::now_nsecs() - start,m_samples);
+				}
+			}
+
+			for (size_t i = 0; i < slots.size(); ++i)
+				m_proactor->stop_timer(slots.at(i));
+
+			return err;
+		}
+
+	private:
+		struct Slot
+		{
+			TimerChurn*      m_this;
+			OOBase::uint64_t m_due;
+			size_t           m_index;
+		};
+
+		OOBase::Proactor* m_proactor;
+		size_t            m_fires;
+		size_t            m_fired;
+		Bench::Samples    m_samples;
+
+		unsigned int next_delay(const Slot* slot) const
+		{
+			// Spread the timers over [0,500) usecs so the timer set is constantly reordered
+			return static_cast<unsigned int>((slot->m_index * 37 + m_fired * 11) % 500);
+		}
+
+		static OOBase::Timeout on_timer(void* param)
+		{
+			Slot* slot = static_cast<Slot*>(param);
+			TimerChurn* pThis = slot->m_this;
+
+			OOBase::uint64_t now = Bench::now_nsecs();
+			pThis->m_samples.add(now > slot->m_due ? now - slot->m_due : 0);
+
+			if (++pThis->m_fired >= pThis->m_fires)
+			{
+				if (pThis->m_fired == pThis->m_fires)
+					pThis->m_proactor->stop();
+
+				return OOBase::Timeout();
+			}
+
+			unsigned int delay = pThis->next_delay(slot);
+			slot->m_due = now + delay * 1000;
+			return OOBase::Timeout(0,delay);
+		}
+	};
+
+	int run_timer_churn(const Options& options, size_t timers)
+	{
+		int err = 0;
+		OOBase::Proactor* proactor = OOBase::Proactor::create(err);
+		if (err)
+			return err;
+
+		{
+			TimerChurn churn(proactor,options.m_messages);
+			err = churn.run(timers);
+		}
+
+		OOBase::Proactor::destroy(proactor);
+		return err;
+	}
+#endif
+
+	void check(const char* what, int err)
+	{
+		if (err)
+			fprintf(stderr,"%s failed: %d\n",what,err);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	options.m_messages = (argc > 1 ? strtoul(argv[1],NULL,10) : 100000);
+	options.m_msg_size = (argc > 2 ? strtoul(argv[2],NULL,10) : 64);
+	options.m_clients = (argc > 3 ? strtoul(argv[3],NULL,10) : 8);
+	options.m_idle = (argc > 4 ? strtoul(argv[4],NULL,10) : 1000);
+	options.m_connects = 1000;
+	options.m_port = 17831;
+	options.m_path = "/tmp/oobase_proactor_bench";
+
+	if (!options.m_msg_size)
+		options.m_msg_size = 1;
+
+	Endpoint tcp(options.m_port);
+
+	char variant[32] = {0};
+	for (size_t clients = 1; clients <= options.m_clients; clients *= 2)
+	{
+		snprintf(variant,sizeof(variant),"tcp_c%lu",static_cast<unsigned long>(clients));
+		check(variant,run_echo("echo",variant,tcp,options,clients,0));
+	}
+
+#if !defined(_WIN32)
+	Endpoint local(options.m_path);
+	for (size_t clients = 1; clients <= options.m_clients; clients *= 2)
+	{
+		unlink(options.m_path);
+		snprintf(variant,sizeof(variant),"unix_c%lu",static_cast<unsigned long>(clients));
+		check(variant,run_echo("echo",variant,local,options,clients,0));
+	}
+	unlink(options.m_path);
+#endif
+
+	// A few busy connections among many idle ones
+	snprintf(variant,sizeof(variant),"tcp_i%lu_c%lu",static_cast<unsigned long>(options.m_idle),static_cast<unsigned long>(options.m_clients));
+	check(variant,run_echo("idle_mix",variant,tcp,options,options.m_clients,options.m_idle));
+
+#if !defined(_WIN32)
+	check("timer_churn",run_timer_churn(options,16));
+	check("timer_churn",run_timer_churn(options,1024));
+#endif
+
+	for (size_t threads = 1; threads <= options.m_clients; threads *= 2)
+	{
+		snprintf(variant,sizeof(variant),"tcp_t%lu",static_cast<unsigned long>(threads));
+		check(variant,run_accept_storm(variant,tcp,options,threads));
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -23,13 +23,55 @@
 #define OOBASE_ASYNC_RESPONSE_H_INCLUDED_
 
 #include "CDRStream.h"
+#include "../OOBase/Atomic.h"
+
+#include <new>
+
+#if defined(_MSC_VER)
+#define ASYNC_RESPONSE_THREAD_LOCAL __declspec(thread)
+#else
+#define ASYNC_RESPONSE_THREAD_LOCAL __thread
+#endif
 
 namespace OOBase
 {
-	template <typename H, typename Allocator = CrtAllocator>
+	namespace detail
+	{
+		template <size_t N>
+		struct shard_bits
+		{
+			static const size_t value = 1 + shard_bits<N/2>::value;
+		};
+
+		template <>
+		struct shard_bits<1>
+		{
+			static const size_t value = 0;
+		};
+
+		template <bool b>
+		struct pooled_tag
+		{};
+	}
+
+	/// Dispatches CDRStream responses to registered callbacks by handle.
+	/**
+	 *  The handle table is split into \p Shards independently locked tables, and the
+	 *  index of the owning shard is stored in the low bits of each handle, so
+	 *  concurrent callers only contend when they hit the same shard.
+	 *  \p Shards must be a power of 2; the default of 1 gives the original single table.
+	 *
+	 *  Delegates that fit are constructed in fixed-size slots recycled through a
+	 *  per-shard free list, use reserve() to preallocate slots and handle table
+	 *  capacity for the expected number of outstanding responses.
+	 */
+	template <typename H, typename Allocator = CrtAllocator, size_t Shards = 1>
 	class AsyncResponseDispatcher : public Allocating<Allocator>
 	{
 		typedef Allocating<Allocator> baseClass;
+
+		static_assert(Shards > 0 && (Shards & (Shards - 1)) == 0,"Shards must be a power of 2");
+
 	public:
 		AsyncResponseDispatcher() : baseClass()
 		{}
@@ -37,24 +79,80 @@ namespace OOBase
 		AsyncResponseDispatcher(AllocatorInstance& instance) : baseClass(instance)
 		{}
 
+		explicit AsyncResponseDispatcher(size_t capacity) : baseClass()
+		{
+			reserve(capacity);
+		}
+
+		AsyncResponseDispatcher(AllocatorInstance& instance, size_t capacity) : baseClass(instance)
+		{
+			reserve(capacity);
+		}
+
 		~AsyncResponseDispatcher()
 		{
-			OOBase::Guard<OOBase::SpinLock> guard(m_lock);
+			drop_all();
 
-			DelegateV* resp = NULL;
-			H handle;
-			while (m_response_table.pop(&handle,&resp))
+			// drop_all() has returned every slot to its shard, so the chunks are unused
+			for (size_t i = 0; i < Shards; ++i)
+			{
+				Shard& shard = m_shards[i].m_shard;
+				while (shard.m_chunks)
+				{
+					SlotChunk* chunk = shard.m_chunks;
+					shard.m_chunks = chunk->m_next;
+					baseClass::free(chunk);
+				}
+			}
+		}
+
+		/// Preallocate delegate slots and handle table capacity for at least \p count outstanding responses.
+		bool reserve(size_t count)
+		{
+			size_t per_shard = (count + Shards - 1) / Shards;
+			for (size_t i = 0; per_shard && i < Shards; ++i)
+			{
+				Shard& shard = m_shards[i].m_shard;
+
+				OOBase::Guard<OOBase::SpinLock> guard(shard.m_lock);
+
+				if (!shard.m_response_table.reserve(shard.m_response_table.size() + per_shard))
+					return false;
+
+				size_t have = shard.m_free_count;
+
+				guard.release();
+
+				if (have < per_shard && !grow(i,per_shard - have))
+					return false;
+			}
+			return true;
+		}
+
+		/// Drop every outstanding response, calling each callback with an empty stream.
+		void drop_all()
+		{
+			for (size_t i = 0; i < Shards; ++i)
 			{
-				if (resp)
+				Shard& shard = m_shards[i].m_shard;
+
+				OOBase::Guard<OOBase::SpinLock> guard(shard.m_lock);
+
+				DelegateV* resp = NULL;
+				H handle;
+				while (shard.m_response_table.pop(&handle,&resp))
 				{
-					guard.release();
+					if (resp)
+					{
+						guard.release();
 
-					OOBase::CDRStream stream(0);
-					resp->call(stream);
+						OOBase::CDRStream stream(0);
+						resp->call(stream);
 
-					resp->destroy(this);
+						free_delegate(resp,i);
 
-					guard.acquire();
+						guard.acquire();
+					}
 				}
 			}
 		}
@@ -62,88 +160,86 @@ namespace OOBase
 		template <typename T>
 		bool add_response(T* pThis, bool (T::*callback)(OOBase::CDRStream&), H& handle)
 		{
-			Delegate0<T>* d = NULL;
-			if (!baseClass::allocate_new(d,pThis,callback))
-				return false;
-
-			bool ret = add_response(d,handle);
-			if (!ret)
-				baseClass::delete_free(d);
-			return ret;
+			return add_delegate(Delegate0<T>(pThis,callback),handle);
 		}
 
 		template <typename T, typename P1, typename PP1>
 		bool add_response(T* pThis, bool (T::*callback)(OOBase::CDRStream&, P1 p1), PP1 p1, H& handle)
 		{
-			Delegate1<T,P1,PP1>* d = NULL;
-			if (!baseClass::allocate_new(d,pThis,callback,p1))
-				return false;
-
-			bool ret = add_response(d,handle);
-			if (!ret)
-				baseClass::delete_free(d);
-			return ret;
+			return add_delegate(Delegate1<T,P1,PP1>(pThis,callback,p1),handle);
 		}
 
 		template <typename T, typename P1, typename P2, typename PP1, typename PP2>
 		bool add_response(T* pThis, bool (T::*callback)(OOBase::CDRStream&, P1 p1, P2 p2), PP1 p1, PP2 p2, H& handle)
 		{
-			Delegate2<T,P1,P2,PP1,PP2>* d = NULL;
-			if (!baseClass::allocate_new(d,pThis,callback,p1,p2))
-				return false;
-
-			bool ret = add_response(d,handle);
-			if (!ret)
-				baseClass::delete_free(d);
-			return ret;
+			return add_delegate(Delegate2<T,P1,P2,PP1,PP2>(pThis,callback,p1,p2),handle);
 		}
 
 		template <typename T, typename P1, typename P2, typename P3, typename PP1, typename PP2, typename PP3>
 		bool add_response(T* pThis, bool (T::*callback)(OOBase::CDRStream&, P1 p1, P2 p2, P3 p3), PP1 p1, PP2 p2, PP3 p3, H& handle)
 		{
-			Delegate3<T,P1,P2,P3,PP1,PP2,PP3>* d = NULL;
-			if (!baseClass::allocate_new(d,pThis,callback,p1,p2,p3))
-				return false;
-
-			bool ret = add_response(d,handle);
-			if (!ret)
-				baseClass::delete_free(d);
-			return ret;
+			return add_delegate(Delegate3<T,P1,P2,P3,PP1,PP2,PP3>(pThis,callback,p1,p2,p3),handle);
 		}
 
 		void drop_response(H handle)
 		{
-			OOBase::Guard<OOBase::SpinLock> guard(m_lock);
+			size_t idx = handle & (Shards - 1);
+			Shard& shard = m_shards[idx].m_shard;
+
+			OOBase::Guard<OOBase::SpinLock> guard(shard.m_lock);
 
 			DelegateV* resp = NULL;
-			if (m_response_table.remove(handle,&resp) && resp)
+			if (shard.m_response_table.remove(handle >> detail::shard_bits<Shards>::value,&resp) && resp)
 			{
 				guard.release();
 
 				OOBase::CDRStream stream(0);
 				resp->call(stream);
 
-				resp->destroy(this);
+				free_delegate(resp,idx);
 			}
 		}
 
+		/// Remove the response for \p handle without calling it.
+		bool cancel_response(H handle)
+		{
+			size_t idx = handle & (Shards - 1);
+			Shard& shard = m_shards[idx].m_shard;
+
+			OOBase::Guard<OOBase::SpinLock> guard(shard.m_lock);
+
+			DelegateV* resp = NULL;
+			if (!shard.m_response_table.remove(handle >> detail::shard_bits<Shards>::value,&resp))
+				return false;
+
+			guard.release();
+
+			if (resp)
+				free_delegate(resp,idx);
+
+			return true;
+		}
+
 		bool handle_response(OOBase::CDRStream& stream)
 		{
 			H handle = 0;
 			if (!stream.read(handle))
 				return false;
 
-			OOBase::Guard<OOBase::SpinLock> guard(m_lock);
+			size_t idx = handle & (Shards - 1);
+			Shard& shard = m_shards[idx].m_shard;
+
+			OOBase::Guard<OOBase::SpinLock> guard(shard.m_lock);
 
 			DelegateV* resp;
-			if (!m_response_table.remove(handle,&resp) || !resp)
+			if (!shard.m_response_table.remove(handle >> detail::shard_bits<Shards>::value,&resp) || !resp)
 				return false;
 
 			guard.release();
 
 			bool ret = resp->call(stream);
 
-			resp->destroy(this);
+			free_delegate(resp,idx);
 
 			return ret;
 		}
@@ -151,15 +247,14 @@ namespace OOBase
 	private:
 		struct DelegateV
 		{
-			virtual bool call(OOBase::CDRStream& stream) = 0;
+			DelegateV() : m_slot(NULL)
+			{}
 
-			void destroy(Allocating<Allocator>* allocator)
-			{
-				(void)allocator;
-				allocator->delete_free(this);
-			}
+			virtual bool call(OOBase::CDRStream& stream) = 0;
 
 			virtual ~DelegateV() {}
+
+			void* m_slot; ///< The pool slot holding this delegate, or NULL if heap allocated.
 		};
 
 		template <typename T>
@@ -290,14 +385,218 @@ namespace OOBase
 			}
 		};
 
-		OOBase::SpinLock                    m_lock;
-		HandleTable<H,DelegateV*,Allocator> m_response_table;
+		// Slots are sized to fit the largest DelegateN with pointer-sized parameters
+		struct SlotDummy {};
+		typedef Delegate3<SlotDummy,void*,void*,void*,void*,void*,void*> LargestDelegate;
+
+		union Slot
+		{
+			Slot*  m_next;
+			void*  m_align_ptr;
+			double m_align_double;
+			char   m_data[sizeof(LargestDelegate)];
+		};
+
+		struct SlotChunk
+		{
+			SlotChunk* m_next;
+			Slot       m_slots[1];
+		};
+
+		static const size_t ChunkSlots = 32;
+
+		struct Shard
+		{
+			Shard() : m_free_slots(NULL), m_free_count(0), m_chunks(NULL)
+			{}
+
+			OOBase::SpinLock                    m_lock;
+			HandleTable<H,DelegateV*,Allocator> m_response_table;
+			Slot*                               m_free_slots;
+			size_t                              m_free_count;
+			SlotChunk*                          m_chunks;
+		};
+
+		// Pad each shard out to its own cache line(s) to avoid false sharing
+		struct PaddedShard
+		{
+			Shard m_shard;
+			char  m_pad[64 - (sizeof(Shard) % 64)];
+		};
+
+		PaddedShard m_shards[Shards];
+
+		static size_t shard_hint()
+		{
+			if (Shards == 1)
+				return 0;
+
+			// Each thread takes the next index on first use, so concurrent callers
+			// are dealt round the shards.  Stored plus one, as 0 means unassigned
+			static ASYNC_RESPONSE_THREAD_LOCAL size_t t_hint = 0;
+			if (!t_hint)
+			{
+				static size_t s_next = 0;
+				size_t n = 0;
+				do
+				{
+					n = s_next;
+				}
+				while (Atomic<size_t>::CompareAndSwap(s_next,n,n + 1) != n);
+
+				t_hint = n + 1;
+			}
+
+			return (t_hint - 1) & (Shards - 1);
+		}
+
+		bool insert_response(Shard& shard, size_t idx, DelegateV* delegate, H& handle)
+		{
+			H h = 0;
+			if (!shard.m_response_table.insert(delegate,h))
+				return false;
+
+			// Make sure the shard index still fits in the handle
+			if (h > (H(-1) >> detail::shard_bits<Shards>::value))
+			{
+				shard.m_response_table.remove(h,NULL);
+				return false;
+			}
+
+			handle = static_cast<H>((h << detail::shard_bits<Shards>::value) | idx);
+			return true;
+		}
+
+		size_t lock_shard()
+		{
+			size_t start = shard_hint();
+
+			// Take the first uncontended shard, starting at our preferred one
+			for (size_t i = 0; i < Shards; ++i)
+			{
+				size_t idx = (start + i) & (Shards - 1);
+				if (m_shards[idx].m_shard.m_lock.tryacquire())
+					return idx;
+			}
+
+			// Everyone is busy, wait for our own shard
+			m_shards[start].m_shard.m_lock.acquire();
+			return start;
+		}
 
 		bool add_response(DelegateV* delegate, H& handle)
 		{
-			OOBase::Guard<OOBase::SpinLock> guard(m_lock);
+			size_t idx = lock_shard();
+			Shard& shard = m_shards[idx].m_shard;
+
+			bool ret = insert_response(shard,idx,delegate,handle);
+
+			shard.m_lock.release();
+
+			return ret;
+		}
+
+		template <typename D>
+		bool add_delegate(const D& delegate, H& handle)
+		{
+			return add_delegate(delegate,handle,detail::pooled_tag<(sizeof(D) <= sizeof(Slot) && alignment_of<D>::value <= alignment_of<Slot>::value)>());
+		}
+
+		template <typename D>
+		bool add_delegate(const D& delegate, H& handle, const detail::pooled_tag<false>&)
+		{
+			// Too big for a slot, fall back to the allocator
+			D* d = NULL;
+			if (!baseClass::allocate_new(d,delegate))
+				return false;
+
+			bool ret = add_response(d,handle);
+			if (!ret)
+				baseClass::delete_free(d);
+			return ret;
+		}
+
+		template <typename D>
+		bool add_delegate(const D& delegate, H& handle, const detail::pooled_tag<true>&)
+		{
+			// The slot and the handle come from the same shard, under a single lock
+			size_t idx = lock_shard();
+			Shard& shard = m_shards[idx].m_shard;
+
+			while (!shard.m_free_slots)
+			{
+				// grow() allocates outside of the lock, then retry on the shard it grew
+				shard.m_lock.release();
+
+				if (!grow(idx,ChunkSlots))
+					return false;
+
+				shard.m_lock.acquire();
+			}
+
+			Slot* slot = shard.m_free_slots;
+			shard.m_free_slots = slot->m_next;
+			--shard.m_free_count;
+
+			D* d = ::new (slot) D(delegate);
+			d->m_slot = slot;
+
+			bool ret = insert_response(shard,idx,d,handle);
+			if (!ret)
+			{
+				d->~D();
+
+				slot->m_next = shard.m_free_slots;
+				shard.m_free_slots = slot;
+				++shard.m_free_count;
+			}
+
+			shard.m_lock.release();
+
+			return ret;
+		}
+
+		void free_delegate(DelegateV* delegate, size_t idx)
+		{
+			Slot* slot = static_cast<Slot*>(delegate->m_slot);
+			if (!slot)
+				baseClass::delete_free(delegate);
+			else
+			{
+				delegate->~DelegateV();
+
+				Shard& shard = m_shards[idx].m_shard;
+
+				OOBase::Guard<OOBase::SpinLock> guard(shard.m_lock);
+
+				slot->m_next = shard.m_free_slots;
+				shard.m_free_slots = slot;
+				++shard.m_free_count;
+			}
+		}
+
+		bool grow(size_t idx, size_t count)
+		{
+			// Allocate outside of the lock
+			SlotChunk* chunk = static_cast<SlotChunk*>(baseClass::allocate(sizeof(SlotChunk) + (count - 1) * sizeof(Slot),alignment_of<SlotChunk>::value));
+			if (!chunk)
+				return false;
+
+			for (size_t i = 0; i < count - 1; ++i)
+				chunk->m_slots[i].m_next = &chunk->m_slots[i+1];
+
+			Shard& shard = m_shards[idx].m_shard;
+
+			OOBase::Guard<OOBase::SpinLock> guard(shard.m_lock);
+
+			chunk->m_slots[count - 1].m_next = shard.m_free_slots;
+			shard.m_free_slots = chunk->m_slots;
+			shard.m_free_count += count;
+
+			chunk->m_next = shard.m_chunks;
+			shard.m_chunks = chunk;
 
-			return m_response_table.insert(delegate,handle);
+			return true;
 		}
 
 	public:
@@ -44,6 +44,9 @@ namespace OOBase
 	    m_buffer     rd_ptr()        wr_ptr()     m_capacity
 	                    |<------------->|<------------>|
 	                         length()        space()      \endverbatim
+	 *  A read-only Buffer wraps memory it must not modify: its wr_ptr() is fixed at the end of
+	 *  the data, so space() is always 0, and every operation that would write fails or leaves
+	 *  the contents untouched.
 	 *  \warning This class is not thread-safe.
 	 */
 	class Buffer : public RefCounted
@@ -81,15 +84,18 @@ namespace OOBase
 		size_t length() const;
 
 		/// Reset the read and write pointers to start().
+		/** A read-only buffer is emptied by moving rd_ptr() to wr_ptr() instead. */
 		void reset();
 
 		/// Move the read to start() and copy any existing data 'up' with it, setting wr_ptr() correctly.
+		/** A read-only buffer is never compacted. */
 		void compact();
 
 		/// Get the amount of space remaining in bytes.
 		size_t space() const;
 
 		/// Adjust the amount of space remaining.
+		/** Fails with ERROR_OUTOFMEMORY for any non-zero \p cbSpace on a read-only buffer. */
 		int space(size_t cbSpace);
 
 		/// Return rd_ptr as an offset
@@ -102,20 +108,28 @@ namespace OOBase
 		size_t mark_wr_ptr() const;
 
 		/// Move wr_ptr to mark
+		/** Ignored by a read-only buffer. */
 		void mark_wr_ptr(size_t mark);
 
+		/// Check if the buffer is read-only
+		bool read_only() const;
+
 	protected:
 		virtual uint8_t* reallocate(uint8_t* data, size_t size, size_t align) = 0;
 
 		Buffer(uint8_t* buffer, size_t cbSize, size_t align);
 
+		/// Construct a read-only buffer holding the \p cbSize bytes at \p buffer.
+		Buffer(const uint8_t* buffer, size_t cbSize);
+
 		uint8_t* m_buffer;   ///< The actual underlying buffer.
 
 	private:
-		size_t   m_capacity; ///< The total allocated bytes for \p m_buffer.
-		size_t   m_align;    ///< The alignment of the start of \p m_buffer.
-		uint8_t* m_wr_ptr;   ///< The current write pointer.
-		uint8_t* m_rd_ptr;   ///< The current read pointer.
+		size_t   m_capacity;  ///< The total allocated bytes for \p m_buffer.
+		size_t   m_align;     ///< The alignment of the start of \p m_buffer.
+		uint8_t* m_wr_ptr;    ///< The current write pointer.
+		uint8_t* m_rd_ptr;    ///< The current read pointer.
+		bool     m_read_only; ///< The contents of \p m_buffer must not be written.
 	};
 
 	namespace detail
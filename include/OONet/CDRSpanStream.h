@@ -0,0 +1,83 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef OOBASE_CDR_SPAN_STREAM_H_INCLUDED_
+#define OOBASE_CDR_SPAN_STREAM_H_INCLUDED_
+
+#include "CDRStream.h"
+
+namespace OOBase
+{
+	/// A read-only CDRStream over memory it does not own.
+	/**
+	 *  The stream decodes directly from \p data, which must remain valid and unchanged for the
+	 *  lifetime of the stream.  It has the same read API and error semantics as CDRStream, so
+	 *  types with their own read() members work unchanged.
+	 *  Alignment is relative to the address of each field, so \p data must start on the same
+	 *  boundary (modulo CDRStream::MaxAlignment) as the buffer it was encoded into.
+	 *  The span is wrapped in a read-only Buffer, so writes fail with ERROR_OUTOFMEMORY, and
+	 *  reset() and compact() never touch \p data, even when called through CDRStream&.  Do not
+	 *  hold references to buffer() beyond the lifetime of the stream.
+	 */
+	class CDRSpanStream : public CDRStream, public NonCopyable
+	{
+	public:
+		CDRSpanStream(const uint8_t* data, size_t len) :
+				CDRStream(size_t(0)),
+				m_span(data,len)
+		{
+			// The stream holds the only reference to m_span, released in our destructor
+			m_buffer = &m_span;
+		}
+
+		~CDRSpanStream()
+		{
+			m_buffer = NULL;
+		}
+
+	private:
+		/// A read-only Buffer that wraps the span and never frees or reallocates it
+		class SpanBuffer : public Buffer
+		{
+		public:
+			SpanBuffer(const uint8_t* data, size_t len) :
+					Buffer(data,len)
+			{
+			}
+
+		private:
+			void destroy()
+			{
+				// Embedded in CDRSpanStream, nothing to free
+			}
+
+			uint8_t* reallocate(uint8_t*, size_t, size_t)
+			{
+				return NULL;
+			}
+		};
+
+		SpanBuffer m_span;
+	};
+}
+
+#endif // OOBASE_CDR_SPAN_STREAM_H_INCLUDED_
@@ -25,10 +25,58 @@
 #include "Buffer.h"
 #include "ByteSwap.h"
 
+// GCC and clang can build the SSSE3 and AVX2 byte-swaps without -mssse3 or -mavx2,
+// and pick one at runtime, so the default -O2 build still uses them
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#define OOBASE_CDR_SWAP_SIMD 1
+#include <immintrin.h>
+#endif
+
 namespace OOBase
 {
 	class CDRStream;
 
+	/// Describes the data member \p Member of type \p T in struct \p S, for use in a CDRFields list.
+	template <typename S, typename T, T S::*Member>
+	struct CDRField
+	{
+		typedef S struct_type;
+		typedef T value_type;
+
+		static const T& get(const S& s)
+		{
+			return s.*Member;
+		}
+
+		static T& get(S& s)
+		{
+			return s.*Member;
+		}
+	};
+
+	/// Terminates a CDRFields list
+	struct CDRFieldsEnd {};
+
+	/** A compile-time list of CDRField descriptions, read and written by CDRStream::read_fields()
+	 *  and CDRStream::write_fields().  For example:
+	 *  \code
+	 *  struct Header { uint32_t id; uint16_t flags; uint64_t stamp; };
+	 *
+	 *  typedef CDRFields<CDRField<Header,uint32_t,&Header::id>,
+	 *          CDRFields<CDRField<Header,uint16_t,&Header::flags>,
+	 *          CDRFields<CDRField<Header,uint64_t,&Header::stamp> > > > HeaderFields;
+	 *
+	 *  stream.write_fields<HeaderFields>(hdr);
+	 *  \endcode
+	 *  All fields must be POD.
+	 */
+	template <typename Field, typename Next = CDRFieldsEnd>
+	struct CDRFields
+	{
+		typedef Field field;
+		typedef Next next;
+	};
+
 	namespace detail
 	{
 		namespace stream
@@ -60,6 +108,185 @@ namespace OOBase
 
 			template <bool s>
 			struct write_impl;
+
+			template <typename Fields, size_t Start>
+			struct field_layout;
+
+			template <bool b>
+			struct packed_tag {};
+
+			/// Integer types that a packed CDRStream writes as varints, single bytes are written as-is
+			template <typename T>
+			struct packed_int
+			{
+				static const bool value = false;
+			};
+
+			template <typename T, typename U, bool bSigned>
+			struct packed_int_base;
+
+			template <typename T, typename U>
+			struct packed_int_base<T,U,false>
+			{
+				static const bool value = true;
+				typedef U unsigned_type;
+
+				static U encode(T v) { return v; }
+				static T decode(U u) { return u; }
+			};
+
+			/// Zigzag encoding, so small negative numbers stay short
+			template <typename T, typename U>
+			struct packed_int_base<T,U,true>
+			{
+				static const bool value = true;
+				typedef U unsigned_type;
+
+				static U encode(T v) { return (U(v) << 1) ^ U(v >> (sizeof(T) * 8 - 1)); }
+				static T decode(U u) { return T((u >> 1) ^ (U(0) - (u & 1))); }
+			};
+
+			template <> struct packed_int<short> : public packed_int_base<short,unsigned short,true> {};
+			template <> struct packed_int<unsigned short> : public packed_int_base<unsigned short,unsigned short,false> {};
+			template <> struct packed_int<int> : public packed_int_base<int,unsigned int,true> {};
+			template <> struct packed_int<unsigned int> : public packed_int_base<unsigned int,unsigned int,false> {};
+			template <> struct packed_int<long> : public packed_int_base<long,unsigned long,true> {};
+			template <> struct packed_int<unsigned long> : public packed_int_base<unsigned long,unsigned long,false> {};
+			template <> struct packed_int<long long> : public packed_int_base<long long,unsigned long long,true> {};
+			template <> struct packed_int<unsigned long long> : public packed_int_base<unsigned long long,unsigned long long,false> {};
+
+			/// Types read_array() and write_array() can byte-swap in bulk, reversing a struct would reorder its fields
+			template <typename T>
+			struct array_element
+			{
+				static const bool value = false;
+			};
+
+			template <> struct array_element<char> { static const bool value = true; };
+			template <> struct array_element<signed char> { static const bool value = true; };
+			template <> struct array_element<unsigned char> { static const bool value = true; };
+			template <> struct array_element<short> { static const bool value = true; };
+			template <> struct array_element<unsigned short> { static const bool value = true; };
+			template <> struct array_element<int> { static const bool value = true; };
+			template <> struct array_element<unsigned int> { static const bool value = true; };
+			template <> struct array_element<long> { static const bool value = true; };
+			template <> struct array_element<unsigned long> { static const bool value = true; };
+			template <> struct array_element<long long> { static const bool value = true; };
+			template <> struct array_element<unsigned long long> { static const bool value = true; };
+			template <> struct array_element<float> { static const bool value = true; };
+			template <> struct array_element<double> { static const bool value = true; };
+
+			/// Byte shuffle that reverses each N byte element within a 16 byte lane
+			template <size_t N>
+			inline void swap_mask(uint8_t mask[16])
+			{
+				static_assert(16 % N == 0,"Elements must not straddle a 16 byte lane");
+
+				for (size_t j = 0; j < 16; ++j)
+					mask[j] = static_cast<uint8_t>((j / N) * N + (N - 1 - (j % N)));
+			}
+
+#if defined(OOBASE_CDR_SWAP_SIMD)
+			/// 0 for none, 1 for SSSE3, 2 for AVX2
+			inline int swap_simd_detect()
+			{
+				__builtin_cpu_init();
+				if (__builtin_cpu_supports("avx2"))
+					return 2;
+				if (__builtin_cpu_supports("ssse3"))
+					return 1;
+				return 0;
+			}
+
+			inline int swap_simd_level()
+			{
+				static const int level = swap_simd_detect();
+				return level;
+			}
+
+			/// Shuffle whole 16 byte lanes with \p m, returns the number of bytes copied
+			__attribute__((target("ssse3")))
+			inline size_t swap_copy_ssse3(uint8_t* dest, const uint8_t* src, size_t bytes, const uint8_t m[16])
+			{
+				const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m));
+
+				size_t i = 0;
+				for (; i + 16 <= bytes; i += 16)
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)),mask));
+				return i;
+			}
+
+			/// Shuffle pairs of 16 byte lanes with \p m, then any last lane, returns the number of bytes copied
+			__attribute__((target("avx2")))
+			inline size_t swap_copy_avx2(uint8_t* dest, const uint8_t* src, size_t bytes, const uint8_t m[16])
+			{
+				const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m));
+				const __m256i mask2 = _mm256_broadcastsi128_si256(mask);
+
+				size_t i = 0;
+				for (; i + 32 <= bytes; i += 32)
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i),_mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)),mask2));
+				for (; i + 16 <= bytes; i += 16)
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)),mask));
+				return i;
+			}
+#endif
+
+			/// Copy \p count elements of \p N bytes each from \p src to \p dest, reversing the bytes of each
+			template <size_t N>
+			inline void swap_copy(uint8_t* dest, const uint8_t* src, size_t count)
+			{
+				size_t bytes = count * N;
+				size_t i = 0;
+
+#if defined(OOBASE_CDR_SWAP_SIMD)
+				if (bytes >= 16)
+				{
+					int level = swap_simd_level();
+					if (level)
+					{
+						uint8_t m[16];
+						swap_mask<N>(m);
+
+						i = (level == 2 ? swap_copy_avx2(dest,src,bytes,m) : swap_copy_ssse3(dest,src,bytes,m));
+					}
+				}
+#endif
+				for (; i < bytes; i += N)
+				{
+					for (size_t j = 0; j < N; ++j)
+						dest[i + j] = src[i + N - 1 - j];
+				}
+			}
+
+			/// Only defined for the element sizes of array_element types
+			template <size_t N>
+			struct array_copy;
+
+			template <size_t N>
+			struct array_copy_swap
+			{
+				static void copy(void* dest, const void* src, size_t count, bool swap)
+				{
+					if (!swap)
+						memcpy(dest,src,count * N);
+					else
+						swap_copy<N>(static_cast<uint8_t*>(dest),static_cast<const uint8_t*>(src),count);
+				}
+			};
+
+			template <> struct array_copy<2> : public array_copy_swap<2> {};
+			template <> struct array_copy<4> : public array_copy_swap<4> {};
+			template <> struct array_copy<8> : public array_copy_swap<8> {};
+
+			template <>
+			struct array_copy<1>
+			{
+				static void copy(void* dest, const void* src, size_t count, bool)
+				{
+					memcpy(dest,src,count);
+				}
+			};
 		}
 	}
 
@@ -68,9 +295,16 @@ namespace OOBase
 	public:
 		static const int MaxAlignment = 16;
 
+		/// Set in the endianess header of a packed stream
+		static const uint16_t PackedFlag = 0x8000;
+
+		/// The default limit on a peer-supplied frame length, used by the framed readers
+		static const size_t DefaultMaxFrame = 16 * 1024 * 1024;
+
 		CDRStream(size_t len = 256) :
 				m_endianess(OOBASE_BYTE_ORDER),
-				m_last_error(0)
+				m_last_error(0),
+				m_packed(false)
 		{
 			if (len > 0)
 			{
@@ -82,7 +316,8 @@ namespace OOBase
 
 		CDRStream(AllocatorInstance& allocator, size_t len = 256) :
 				m_endianess(OOBASE_BYTE_ORDER),
-				m_last_error(0)
+				m_last_error(0),
+				m_packed(false)
 		{
 			m_buffer = Buffer::create(allocator,len,MaxAlignment);
 			if (!m_buffer)
@@ -92,13 +327,15 @@ namespace OOBase
 		CDRStream(const RefPtr<Buffer>& buffer) :
 				m_buffer(buffer),
 				m_endianess(OOBASE_BYTE_ORDER),
-				m_last_error(0)
+				m_last_error(0),
+				m_packed(false)
 		{ }
 
 		CDRStream(const CDRStream& rhs) :
 				m_buffer(rhs.m_buffer),
 				m_endianess(rhs.m_endianess),
-				m_last_error(rhs.m_last_error)
+				m_last_error(rhs.m_last_error),
+				m_packed(rhs.m_packed)
 		{ }
 
 		CDRStream& operator = (const CDRStream& rhs)
@@ -159,6 +396,22 @@ namespace OOBase
 			return m_endianess;
 		}
 
+		/** Select the packed wire format.
+		 *  A packed stream has no alignment padding, and integers wider than a byte are written as
+		 *  LEB128 varints, zigzag encoded if signed.  write_endianess() announces the mode to the
+		 *  reader by setting \p PackedFlag in the header.
+		 *  replace() cannot be used on the integer fields of a packed stream, as their size varies.
+		 */
+		void packed(bool packed)
+		{
+			m_packed = packed;
+		}
+
+		bool packed() const
+		{
+			return m_packed;
+		}
+
 		bool write_endianess()
 		{
 			if (m_last_error != 0)
@@ -176,8 +429,12 @@ namespace OOBase
 				return false;
 
 			uint8_t* wr_ptr = m_buffer->wr_ptr();
-			wr_ptr[0] = static_cast<uint8_t>(m_endianess >> 8);
-			wr_ptr[1] = static_cast<uint8_t>(m_endianess & 0xFF);
+			uint16_t header = m_endianess;
+			if (m_packed)
+				header |= PackedFlag;
+
+			wr_ptr[0] = static_cast<uint8_t>(header >> 8);
+			wr_ptr[1] = static_cast<uint8_t>(header & 0xFF);
 
 			m_buffer->wr_ptr(2);
 
@@ -197,7 +454,9 @@ namespace OOBase
 				return error_eof();
 
 			const uint8_t* rd_ptr = m_buffer->rd_ptr();
-			m_endianess = (rd_ptr[0] << 8) | rd_ptr[1];
+			uint16_t header = (rd_ptr[0] << 8) | rd_ptr[1];
+			m_packed = ((header & PackedFlag) != 0);
+			m_endianess = (header & ~PackedFlag);
 			m_buffer->rd_ptr(2);
 			return true;
 		}
@@ -250,6 +509,55 @@ namespace OOBase
 			return (m_last_error == 0);
 		}
 
+		/** Read a string without copying it.
+		 *  On success \p str points into buffer() and is not NUL terminated.  It remains valid
+		 *  while the buffer is alive and its contents before rd_ptr() are not compacted or reset.
+		 */
+		bool read_string_view(const char*& str, size_t& len)
+		{
+			str = NULL;
+			len = 0;
+
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_eof();
+
+			size_t l = 0;
+			if (!read_dyn_int(l))
+				return false;
+
+			if (l > m_buffer->length())
+				return error_too_big();
+
+			str = reinterpret_cast<const char*>(m_buffer->rd_ptr());
+			len = l;
+			m_buffer->rd_ptr(l);
+			return true;
+		}
+
+		/** Read \p count bytes without copying them.
+		 *  On success \p data points into buffer(), with the same lifetime as read_string_view().
+		 */
+		bool read_blob_view(const uint8_t*& data, size_t count)
+		{
+			data = NULL;
+
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_eof();
+
+			if (count > m_buffer->length())
+				return error_eof();
+
+			data = m_buffer->rd_ptr();
+			m_buffer->rd_ptr(count);
+			return true;
+		}
+
 		size_t read_bytes(uint8_t* buffer, size_t count)
 		{
 			if (m_last_error != 0)
@@ -269,11 +577,92 @@ namespace OOBase
 			return count;
 		}
 
+		/** Read an array of \p count values of type \p T.
+		 *  The wire format is identical to \p count calls to read(), but the length is checked once
+		 *  and the values are copied (and byte-swapped if required) in bulk.
+		 */
+		template <typename T>
+		bool read_array(T* vals, size_t count)
+		{
+			static_assert(detail::stream::array_element<T>::value,"Attempting to read_array a non-arithmetic type");
+
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_eof();
+
+			if (!count)
+				return true;
+
+			if (m_packed)
+			{
+				for (size_t i = 0; i < count; ++i)
+				{
+					if (!read_raw(vals[i]))
+						return false;
+				}
+				return true;
+			}
+
+			if (count > size_t(-1) / sizeof(T))
+				return error_too_big();
+
+			m_buffer->align_rd_ptr(alignment_of<T>::value);
+			if (m_buffer->length() < count * sizeof(T))
+				return error_eof();
+
+			detail::stream::array_copy<sizeof(T)>::copy(vals,m_buffer->rd_ptr(),count,m_endianess != OOBASE_BYTE_ORDER);
+			m_buffer->rd_ptr(count * sizeof(T));
+			return true;
+		}
+
+		/// A specialization of read_array() for type \p bool, which must be normalised.
+		bool read_array(bool* vals, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (!read(vals[i]))
+					return false;
+			}
+			return true;
+		}
+
+		/** Read a struct described by the CDRFields list \p Fields.
+		 *  The layout is computed at compile time, so the whole struct is length checked once and
+		 *  then loaded without further checks.  See write_fields().
+		 */
+		template <typename Fields, typename S>
+		bool read_fields(S& val)
+		{
+			typedef detail::stream::field_layout<Fields,0> layout;
+
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_eof();
+
+			if (m_packed)
+				return layout::read_each(*this,val);
+
+			m_buffer->align_rd_ptr(layout::align);
+			if (m_buffer->length() < layout::end)
+				return error_eof();
+
+			layout::load(m_buffer->rd_ptr(),val,m_endianess != OOBASE_BYTE_ORDER);
+			m_buffer->rd_ptr(layout::end);
+			return true;
+		}
+
 		template <typename T>
 		bool read_raw(T& val)
 		{
 			static_assert(detail::is_pod<T>::value,"Attempting to read_raw non-POD");
 
+			if (m_packed)
+				return read_packed(val,detail::stream::packed_tag<detail::stream::packed_int<T>::value>());
+
 			m_buffer->align_rd_ptr(alignment_of<T>::value);
 			if (m_buffer->length() < sizeof(T))
 				return error_eof();
@@ -383,11 +772,105 @@ namespace OOBase
 			return count;
 		}
 
+		/** Write an array of \p count values of type \p T.
+		 *  The wire format is identical to \p count calls to write(), but space() is called once
+		 *  and the values are copied (and byte-swapped if required) in bulk.
+		 */
+		template <typename T>
+		bool write_array(const T* vals, size_t count)
+		{
+			static_assert(detail::stream::array_element<T>::value,"Attempting to write_array a non-arithmetic type");
+
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_too_big();
+
+			if (!count)
+				return true;
+
+			if (m_packed)
+			{
+				for (size_t i = 0; i < count; ++i)
+				{
+					if (!write_raw(vals[i]))
+						return false;
+				}
+				return true;
+			}
+
+			if (count > size_t(-1) / sizeof(T))
+				return error_too_big();
+
+			m_last_error = m_buffer->align_wr_ptr(alignment_of<T>::value);
+			if (m_last_error != 0)
+				return false;
+
+			m_last_error = m_buffer->space(count * sizeof(T));
+			if (m_last_error != 0)
+				return false;
+
+			detail::stream::array_copy<sizeof(T)>::copy(m_buffer->wr_ptr(),vals,count,m_endianess != OOBASE_BYTE_ORDER);
+			m_buffer->wr_ptr(count * sizeof(T));
+			return true;
+		}
+
+		/// A specialization of write_array() for type \p bool, which is written as single bytes of 0 or 1.
+		bool write_array(const bool* vals, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (!write(vals[i]))
+					return false;
+			}
+			return true;
+		}
+
+		/** Write a struct described by the CDRFields list \p Fields.
+		 *  The struct is aligned to its most aligned field, and each field is then aligned as write()
+		 *  would, relative to that start.  The size is known at compile time, so space() is called
+		 *  once.  Packed streams fall back to writing each field in turn.
+		 */
+		template <typename Fields, typename S>
+		bool write_fields(const S& val)
+		{
+			typedef detail::stream::field_layout<Fields,0> layout;
+			static_assert(layout::align <= MaxAlignment,"CDRFields alignment exceeds CDRStream::MaxAlignment");
+
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_too_big();
+
+			if (m_packed)
+				return layout::write_each(*this,val);
+
+			m_last_error = m_buffer->align_wr_ptr(layout::align);
+			if (m_last_error != 0)
+				return false;
+
+			m_last_error = m_buffer->space(layout::end);
+			if (m_last_error != 0)
+				return false;
+
+			// Fill the padding as align_wr_ptr() would
+			uint8_t* wr_ptr = m_buffer->wr_ptr();
+			memset(wr_ptr,0xee,layout::end);
+			layout::store(wr_ptr,val,m_endianess != OOBASE_BYTE_ORDER);
+			m_buffer->wr_ptr(layout::end);
+			return true;
+		}
+
 		template <typename T>
 		bool write_raw(const T& val)
 		{
 			static_assert(detail::is_pod<T>::value,"Attempting to write_raw non-POD");
 
+			if (m_packed)
+				return write_packed(val,detail::stream::packed_tag<detail::stream::packed_int<T>::value>());
+
 			m_last_error = m_buffer->align_wr_ptr(alignment_of<T>::value);
 			if (m_last_error != 0)
 				return false;
@@ -434,12 +917,14 @@ namespace OOBase
 			m_buffer.swap(rhs.m_buffer);
 			OOBase::swap(m_endianess,rhs.m_endianess);
 			OOBase::swap(m_last_error,rhs.m_last_error);
+			OOBase::swap(m_packed,rhs.m_packed);
 		}
 
-	private:
+	protected:
 		RefPtr<Buffer> m_buffer;
 		uint16_t       m_endianess;
 		int            m_last_error;
+		bool           m_packed;
 
 		bool error_eof()
 		{
@@ -461,6 +946,110 @@ namespace OOBase
 			return false;
 		}
 
+	private:
+		template <typename T>
+		bool read_packed(T& val, const detail::stream::packed_tag<true>&)
+		{
+			typename detail::stream::packed_int<T>::unsigned_type u = 0;
+			if (!read_varint(u))
+				return false;
+
+			val = detail::stream::packed_int<T>::decode(u);
+			return true;
+		}
+
+		template <typename T>
+		bool read_packed(T& val, const detail::stream::packed_tag<false>&)
+		{
+			if (m_buffer->length() < sizeof(T))
+				return error_eof();
+
+			T v;
+			memcpy(&v,m_buffer->rd_ptr(),sizeof(T));
+			val = byte_swap(v);
+			m_buffer->rd_ptr(sizeof(T));
+			return true;
+		}
+
+		bool read_packed(bool& val, const detail::stream::packed_tag<false>&)
+		{
+			return read_raw(val);
+		}
+
+		template <typename T>
+		bool write_packed(const T& val, const detail::stream::packed_tag<true>&)
+		{
+			return write_varint(detail::stream::packed_int<T>::encode(val));
+		}
+
+		template <typename T>
+		bool write_packed(const T& val, const detail::stream::packed_tag<false>&)
+		{
+			m_last_error = m_buffer->space(sizeof(T));
+			if (m_last_error != 0)
+				return false;
+
+			T v = byte_swap(val);
+			memcpy(m_buffer->wr_ptr(),&v,sizeof(T));
+			m_buffer->wr_ptr(sizeof(T));
+			return true;
+		}
+
+		bool write_packed(bool val, const detail::stream::packed_tag<false>&)
+		{
+			return write_raw(val);
+		}
+
+		template <typename U>
+		bool read_varint(U& val)
+		{
+			static const size_t bits = sizeof(U) * 8;
+
+			val = 0;
+			for (size_t shift = 0;; shift += 7)
+			{
+				if (m_buffer->length() < 1)
+					return error_eof();
+
+				uint8_t b = *m_buffer->rd_ptr();
+
+				// Reject encodings that do not fit in U
+				if (shift >= bits || (bits - shift < 7 && (U(b & 0x7F) >> (bits - shift)) != 0))
+					return error_too_big();
+
+				m_buffer->rd_ptr(1);
+				val |= U(b & 0x7F) << shift;
+
+				// If hi bit is set, read another byte
+				if (!(b & 0x80))
+					return true;
+			}
+		}
+
+		template <typename U>
+		bool write_varint(U val)
+		{
+			m_last_error = m_buffer->space((sizeof(U) * 8 + 6) / 7);
+			if (m_last_error != 0)
+				return false;
+
+			uint8_t* wr_ptr = m_buffer->wr_ptr();
+			size_t len = 0;
+			do
+			{
+				uint8_t b = static_cast<uint8_t>(val & 0x7F);
+				val >>= 7;
+				if (val)
+					b |= 0x80;
+
+				wr_ptr[len++] = b;
+			}
+			while (val);
+
+			m_buffer->wr_ptr(len);
+			return true;
+		}
+
 		bool read_dyn_int(size_t& len)
 		{
 			len = 0;
@@ -501,6 +1090,221 @@ namespace OOBase
 		}
 	};
 
+	/// A CDRStream whose byte order is fixed at compile time.
+	/** The per-value byte order test in read_raw() and write_raw() disappears, so field accesses
+	 *  can be inlined and vectorised.  Types with their own read() and write() members are still
+	 *  passed a CDRStream&, and see the matching runtime byte order.
+	 *  Use read_fixed_endian() to pick the right stream once from the endianess header.
+	 */
+	template <bool bSwap>
+	class FixedEndianCDRStream : public CDRStream
+	{
+	public:
+		static const uint16_t ByteOrder = (bSwap ? (OOBASE_BYTE_ORDER == OOBASE_LITTLE_ENDIAN ? OOBASE_BIG_ENDIAN : OOBASE_LITTLE_ENDIAN) : OOBASE_BYTE_ORDER);
+
+		FixedEndianCDRStream(size_t len = 256) : CDRStream(len)
+		{
+			m_endianess = ByteOrder;
+		}
+
+		FixedEndianCDRStream(AllocatorInstance& allocator, size_t len = 256) : CDRStream(allocator,len)
+		{
+			m_endianess = ByteOrder;
+		}
+
+		FixedEndianCDRStream(const RefPtr<Buffer>& buffer) : CDRStream(buffer)
+		{
+			m_endianess = ByteOrder;
+		}
+
+		/// Share the buffer and error state of \p rhs, which must already have the byte order \p ByteOrder
+		explicit FixedEndianCDRStream(const CDRStream& rhs) : CDRStream(rhs)
+		{
+			m_endianess = ByteOrder;
+		}
+
+		using CDRStream::read;
+		using CDRStream::read_raw;
+		using CDRStream::read_array;
+		using CDRStream::write;
+		using CDRStream::write_raw;
+		using CDRStream::write_array;
+
+		template <typename T>
+		T byte_swap(const T& val) const
+		{
+			return (bSwap ? OOBase::byte_swap(val) : val);
+		}
+
+		template <typename T>
+		bool read(T& val)
+		{
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_eof();
+
+			return detail::stream::read_impl<detail::stream::has_read_write<T>::has_read>::read(*this,val);
+		}
+
+		template <typename T>
+		bool read_raw(T& val)
+		{
+			static_assert(detail::is_pod<T>::value,"Attempting to read_raw non-POD");
+
+			if (m_packed)
+				return CDRStream::read_raw(val);
+
+			m_buffer->align_rd_ptr(alignment_of<T>::value);
+			if (m_buffer->length() < sizeof(T))
+				return error_eof();
+
+			val = byte_swap(*reinterpret_cast<const T*>(m_buffer->rd_ptr()));
+			m_buffer->rd_ptr(sizeof(T));
+			return true;
+		}
+
+		template <typename T>
+		bool read_array(T* vals, size_t count)
+		{
+			static_assert(detail::stream::array_element<T>::value,"Attempting to read_array a non-arithmetic type");
+
+			if (m_packed)
+				return CDRStream::read_array(vals,count);
+
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_eof();
+
+			if (!count)
+				return true;
+
+			if (count > size_t(-1) / sizeof(T))
+				return error_too_big();
+
+			m_buffer->align_rd_ptr(alignment_of<T>::value);
+			if (m_buffer->length() < count * sizeof(T))
+				return error_eof();
+
+			detail::stream::array_copy<sizeof(T)>::copy(vals,m_buffer->rd_ptr(),count,bSwap);
+			m_buffer->rd_ptr(count * sizeof(T));
+			return true;
+		}
+
+		template <typename T>
+		bool write(const T& val)
+		{
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_too_big();
+
+			return detail::stream::write_impl<detail::stream::has_read_write<T>::has_write>::write(*this,val);
+		}
+
+		template <typename T>
+		bool write_raw(const T& val)
+		{
+			static_assert(detail::is_pod<T>::value,"Attempting to write_raw non-POD");
+
+			if (m_packed)
+				return CDRStream::write_raw(val);
+
+			m_last_error = m_buffer->align_wr_ptr(alignment_of<T>::value);
+			if (m_last_error != 0)
+				return false;
+
+			m_last_error = m_buffer->space(sizeof(T));
+			if (m_last_error != 0)
+				return false;
+
+			*reinterpret_cast<T*>(m_buffer->wr_ptr()) = byte_swap(val);
+			m_buffer->wr_ptr(sizeof(T));
+			return true;
+		}
+
+		template <typename T>
+		bool write_array(const T* vals, size_t count)
+		{
+			static_assert(detail::stream::array_element<T>::value,"Attempting to write_array a non-arithmetic type");
+
+			if (m_packed)
+				return CDRStream::write_array(vals,count);
+
+			if (m_last_error != 0)
+				return false;
+
+			if (!m_buffer)
+				return error_too_big();
+
+			if (!count)
+				return true;
+
+			if (count > size_t(-1) / sizeof(T))
+				return error_too_big();
+
+			m_last_error = m_buffer->align_wr_ptr(alignment_of<T>::value);
+			if (m_last_error != 0)
+				return false;
+
+			m_last_error = m_buffer->space(count * sizeof(T));
+			if (m_last_error != 0)
+				return false;
+
+			detail::stream::array_copy<sizeof(T)>::copy(m_buffer->wr_ptr(),vals,count,bSwap);
+			m_buffer->wr_ptr(count * sizeof(T));
+			return true;
+		}
+	};
+
+	/// The compile-time encoded size and alignment of a CDRFields list
+	template <typename Fields>
+	struct CDRFieldsLayout
+	{
+		static const size_t size = detail::stream::field_layout<Fields,0>::end;
+		static const size_t alignment = detail::stream::field_layout<Fields,0>::align;
+	};
+
+	typedef FixedEndianCDRStream<false> NativeCDRStream;
+	typedef FixedEndianCDRStream<true> SwappedCDRStream;
+
+	/** Read the endianess header from \p stream, then call \p fn once with a NativeCDRStream or a
+	 *  SwappedCDRStream that shares the same buffer.
+	 *  \p fn must provide <tt>template <typename S> bool operator()(S& stream)</tt>.
+	 *  Any error is copied back to \p stream.
+	 */
+	template <typename F>
+	bool read_fixed_endian(CDRStream& stream, F& fn)
+	{
+		if (!stream.read_endianess())
+			return false;
+
+		bool ret;
+		if (stream.endianess() == NativeCDRStream::ByteOrder)
+		{
+			NativeCDRStream fixed(stream);
+			ret = fn(fixed);
+			stream = fixed;
+		}
+		else if (stream.endianess() == SwappedCDRStream::ByteOrder)
+		{
+			SwappedCDRStream fixed(stream);
+			ret = fn(fixed);
+			stream = fixed;
+		}
+		else
+		{
+			// Not one we can fix at compile time, so fall back to the runtime test
+			ret = fn(stream);
+		}
+
+		return ret;
+	}
+
 	namespace detail
 	{
 		namespace stream
@@ -508,8 +1312,8 @@ namespace OOBase
 			template <bool s = true>
 			struct read_impl
 			{
-				template <typename T>
-				static bool read(CDRStream& stream, T& val)
+				template <typename S, typename T>
+				static bool read(S& stream, T& val)
 				{
 					return val.read(stream);
 				}
@@ -518,8 +1322,8 @@ namespace OOBase
 			template <>
 			struct read_impl<false>
 			{
-				template <typename T>
-				static bool read(CDRStream& stream, T& val)
+				template <typename S, typename T>
+				static bool read(S& stream, T& val)
 				{
 					return stream.read_raw(val);
 				}
@@ -528,8 +1332,8 @@ namespace OOBase
 			template <bool s = true>
 			struct write_impl
 			{
-				template <typename T>
-				static bool write(CDRStream& stream, const T& val)
+				template <typename S, typename T>
+				static bool write(S& stream, const T& val)
 				{
 					return val.write(stream);
 				}
@@ -538,12 +1342,105 @@ namespace OOBase
 			template <>
 			struct write_impl<false>
 			{
-				template <typename T>
-				static bool write(CDRStream& stream, const T& val)
+				template <typename S, typename T>
+				static bool write(S& stream, const T& val)
 				{
 					return stream.write_raw(val);
 				}
 			};
+
+			template <typename T>
+			inline void field_store(uint8_t* p, const T& val, bool swap)
+			{
+				T v = (swap ? OOBase::byte_swap(val) : val);
+				memcpy(p,&v,sizeof(T));
+			}
+
+			inline void field_store(uint8_t* p, const bool& val, bool)
+			{
+				*p = (val ? 1 : 0);
+			}
+
+			template <typename T>
+			inline void field_load(const uint8_t* p, T& val, bool swap)
+			{
+				memcpy(&val,p,sizeof(T));
+				if (swap)
+					val = OOBase::byte_swap(val);
+			}
+
+			inline void field_load(const uint8_t* p, bool& val, bool)
+			{
+				val = (*p != 0);
+			}
+
+			template <size_t Start>
+			struct field_layout<CDRFieldsEnd,Start>
+			{
+				static const size_t end = Start;
+				static const size_t align = 1;
+
+				template <typename S>
+				static void store(uint8_t*, const S&, bool)
+				{}
+
+				template <typename S>
+				static void load(const uint8_t*, S&, bool)
+				{}
+
+				template <typename S>
+				static bool write_each(CDRStream&, const S&)
+				{
+					return true;
+				}
+
+				template <typename S>
+				static bool read_each(CDRStream&, S&)
+				{
+					return true;
+				}
+			};
+
+			template <typename Field, typename Next, size_t Start>
+			struct field_layout<CDRFields<Field,Next>,Start>
+			{
+				typedef typename Field::value_type T;
+				static_assert(detail::is_pod<T>::value,"CDRField must be POD");
+
+				static const size_t field_align = alignment_of<T>::value;
+				static const size_t offset = (Start + field_align - 1) & ~(field_align - 1);
+
+				typedef field_layout<Next,offset + sizeof(T)> next_layout;
+
+				static const size_t end = next_layout::end;
+				static const size_t align = (field_align > next_layout::align ? field_align : next_layout::align);
+
+				template <typename S>
+				static void store(uint8_t* p, const S& s, bool swap)
+				{
+					field_store(p + offset,Field::get(s),swap);
+					next_layout::store(p,s,swap);
+				}
+
+				template <typename S>
+				static void load(const uint8_t* p, S& s, bool swap)
+				{
+					field_load(p + offset,Field::get(s),swap);
+					next_layout::load(p,s,swap);
+				}
+
+				template <typename S>
+				static bool write_each(CDRStream& stream, const S& s)
+				{
+					return stream.write(Field::get(s)) && next_layout::write_each(stream,s);
+				}
+
+				template <typename S>
+				static bool read_each(CDRStream& stream, S& s)
+				{
+					return stream.read(Field::get(s)) && next_layout::read_each(stream,s);
+				}
+			};
 		}
 	}
 }
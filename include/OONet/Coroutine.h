@@ -0,0 +1,554 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef OOBASE_COROUTINE_H_INCLUDED_
+#define OOBASE_COROUTINE_H_INCLUDED_
+
+#include "Proactor.h"
+#include "CDRStream.h"
+
+// Coroutine support needs a C++20 compiler, everything else in the library stays C++03
+#if defined(__cpp_impl_coroutine)
+
+#include "../OOBase/Mutex.h"
+#include "../OOBase/Queue.h"
+
+#include <coroutine>
+
+namespace OOBase
+{
+	namespace detail
+	{
+		namespace coroutine
+		{
+			/// Per-thread free lists of coroutine frames in 64 byte size classes.
+			/// A frame freed on another thread joins that thread's lists.
+			class FramePool
+			{
+			public:
+				static const size_t Granule = 64;
+				static const size_t Classes = 32;
+				static const size_t MaxFree = 64;
+
+				static void* allocate(size_t size)
+				{
+					size_t c = (size + Granule - 1) / Granule;
+					if (c >= Classes)
+						return CrtAllocator::allocate(size,Granule);
+
+					FreeList& list = lists()[c];
+					if (list.m_head)
+					{
+						Block* b = list.m_head;
+						list.m_head = b->m_next;
+						--list.m_count;
+						return b;
+					}
+					return CrtAllocator::allocate(c * Granule,Granule);
+				}
+
+				static void free(void* p, size_t size)
+				{
+					size_t c = (size + Granule - 1) / Granule;
+					FreeList& list = lists()[c < Classes ? c : 0];
+					if (c >= Classes || list.m_count >= MaxFree)
+						return CrtAllocator::free(p);
+
+					Block* b = static_cast<Block*>(p);
+					b->m_next = list.m_head;
+					list.m_head = b;
+					++list.m_count;
+				}
+
+			private:
+				struct Block
+				{
+					Block* m_next;
+				};
+
+				struct FreeList
+				{
+					Block* m_head;
+					size_t m_count;
+				};
+
+				struct Lists
+				{
+					FreeList m_lists[Classes];
+
+					~Lists()
+					{
+						for (size_t i = 0; i < Classes; ++i)
+						{
+							while (Block* b = m_lists[i].m_head)
+							{
+								m_lists[i].m_head = b->m_next;
+								CrtAllocator::free(b);
+							}
+						}
+					}
+				};
+
+				static FreeList* lists()
+				{
+					static thread_local Lists s_lists = {};
+					return s_lists.m_lists;
+				}
+			};
+		}
+	}
+
+	/// A fire-and-forget coroutine, it starts when called and frees its frame when it returns.
+	/// Frames come from a pooled allocator, a failed allocation returns a task where failed() is true.
+	class AsyncTask
+	{
+	public:
+		struct promise_type
+		{
+			AsyncTask get_return_object() noexcept
+			{
+				return AsyncTask(false);
+			}
+
+			static AsyncTask get_return_object_on_allocation_failure() noexcept
+			{
+				return AsyncTask(true);
+			}
+
+			std::suspend_never initial_suspend() noexcept
+			{
+				return std::suspend_never();
+			}
+
+			std::suspend_never final_suspend() noexcept
+			{
+				return std::suspend_never();
+			}
+
+			void return_void() noexcept
+			{}
+
+			void unhandled_exception() noexcept
+			{
+				OOBase_CallCriticalFailure("Unhandled exception in coroutine");
+			}
+
+			static void* operator new(size_t size) noexcept
+			{
+				return detail::coroutine::FramePool::allocate(size);
+			}
+
+			static void operator delete(void* p, size_t size) noexcept
+			{
+				detail::coroutine::FramePool::free(p,size);
+			}
+		};
+
+		bool failed() const
+		{
+			return m_failed;
+		}
+
+	private:
+		explicit AsyncTask(bool failed) : m_failed(failed)
+		{}
+
+		bool m_failed;
+	};
+
+	/* The awaitables below complete through the raw void* callbacks of AsyncSocket,
+	 * so awaiting them allocates nothing beyond the coroutine frame they live in.
+	 * The coroutine resumes on the Proactor thread that completed the operation.
+	 * co_await returns the error code, the buffers hold the data as usual. */
+
+	class AwaitRecv
+	{
+	public:
+		AwaitRecv(AsyncSocket* pSocket, const RefPtr<Buffer>& buffer, size_t bytes) :
+				m_socket(pSocket), m_buffer(buffer), m_bytes(bytes), m_err(0)
+		{}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle) noexcept
+		{
+			m_handle = handle;
+
+			// Once the recv is queued, the completion may resume us on another thread
+			int err = m_socket->recv(this,&on_recv,m_buffer,m_bytes);
+			if (err)
+			{
+				m_err = err;
+				return false;
+			}
+			return true;
+		}
+
+		int await_resume() const noexcept
+		{
+			return m_err;
+		}
+
+	private:
+		AsyncSocket*            m_socket;
+		RefPtr<Buffer>          m_buffer;
+		size_t                  m_bytes;
+		int                     m_err;
+		std::coroutine_handle<> m_handle;
+
+		static void on_recv(void* param, const RefPtr<Buffer>&, int err)
+		{
+			AwaitRecv* pThis = static_cast<AwaitRecv*>(param);
+			pThis->m_err = err;
+			pThis->m_handle.resume();
+		}
+	};
+
+	class AwaitSend
+	{
+	public:
+		AwaitSend(AsyncSocket* pSocket, const RefPtr<Buffer>& buffer) :
+				m_socket(pSocket), m_buffer(buffer), m_err(0)
+		{}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle) noexcept
+		{
+			m_handle = handle;
+
+			int err = m_socket->send(this,&on_send,m_buffer);
+			if (err)
+			{
+				m_err = err;
+				return false;
+			}
+			return true;
+		}
+
+		int await_resume() const noexcept
+		{
+			return m_err;
+		}
+
+	private:
+		AsyncSocket*            m_socket;
+		RefPtr<Buffer>          m_buffer;
+		int                     m_err;
+		std::coroutine_handle<> m_handle;
+
+		static void on_send(void* param, const RefPtr<Buffer>&, int err)
+		{
+			AwaitSend* pThis = static_cast<AwaitSend*>(param);
+			pThis->m_err = err;
+			pThis->m_handle.resume();
+		}
+	};
+
+	class AwaitSendV
+	{
+	public:
+		AwaitSendV(AsyncSocket* pSocket, Buffer* buffers[], size_t count) :
+				m_socket(pSocket), m_buffers(buffers), m_count(count), m_err(0)
+		{}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle) noexcept
+		{
+			m_handle = handle;
+
+			int err = m_socket->send_v(this,&on_send_v,m_buffers,m_count);
+			if (err)
+			{
+				m_err = err;
+				return false;
+			}
+			return true;
+		}
+
+		int await_resume() const noexcept
+		{
+			return m_err;
+		}
+
+	private:
+		AsyncSocket*            m_socket;
+		Buffer**                m_buffers;
+		size_t                  m_count;
+		int                     m_err;
+		std::coroutine_handle<> m_handle;
+
+		static void on_send_v(void* param, Buffer*[], size_t, int err)
+		{
+			AwaitSendV* pThis = static_cast<AwaitSendV*>(param);
+			pThis->m_err = err;
+			pThis->m_handle.resume();
+		}
+	};
+
+	/// Reads a message framed by a leading length of type H, as CDRIO::recv_with_header_sync() does.
+	/// A length above \p max_len fails with a protocol error before anything more is read.
+	template <typename H>
+	class AwaitRecvWithHeader
+	{
+	public:
+		AwaitRecvWithHeader(AsyncSocket* pSocket, CDRStream& stream, size_t max_len) :
+				m_socket(pSocket), m_stream(stream), m_max_len(max_len), m_err(0)
+		{}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle) noexcept
+		{
+			m_handle = handle;
+
+			int err = m_socket->recv(this,&on_header,m_stream.buffer(),sizeof(H));
+			if (err)
+			{
+				m_err = err;
+				return false;
+			}
+			return true;
+		}
+
+		int await_resume() const noexcept
+		{
+			return m_err;
+		}
+
+	private:
+		AsyncSocket*            m_socket;
+		CDRStream&              m_stream;
+		size_t                  m_max_len;
+		int                     m_err;
+		std::coroutine_handle<> m_handle;
+
+		static void on_header(void* param, const RefPtr<Buffer>&, int err)
+		{
+			AwaitRecvWithHeader* pThis = static_cast<AwaitRecvWithHeader*>(param);
+			if (!err)
+			{
+				H msg_len = 0;
+				if (!pThis->m_stream.read(msg_len))
+					err = pThis->m_stream.last_error();
+				else if (static_cast<size_t>(msg_len) > pThis->m_max_len)
+				{
+#if defined(_WIN32)
+					err = ERROR_INVALID_DATA;
+#else
+					err = EPROTO;
+#endif
+				}
+				else if (msg_len > sizeof(H))
+				{
+					err = pThis->m_socket->recv(param,&on_body,pThis->m_stream.buffer(),msg_len - sizeof(H));
+					if (!err)
+						return;
+				}
+			}
+
+			pThis->m_err = err;
+			pThis->m_handle.resume();
+		}
+
+		static void on_body(void* param, const RefPtr<Buffer>&, int err)
+		{
+			AwaitRecvWithHeader* pThis = static_cast<AwaitRecvWithHeader*>(param);
+			pThis->m_err = err;
+			pThis->m_handle.resume();
+		}
+	};
+
+	/// Queues the sockets accepted on an address until a coroutine awaits accept()
+	class CoAcceptor : public NonCopyable
+	{
+	public:
+		struct Result
+		{
+			AsyncSocket* m_socket; ///< Owned by the caller
+			int          m_err;
+		};
+
+		class AwaitAccept
+		{
+		public:
+			AwaitAccept(CoAcceptor* acceptor) : m_acceptor(acceptor)
+			{
+				m_result.m_socket = NULL;
+				m_result.m_err = 0;
+			}
+
+			bool await_ready() noexcept
+			{
+				return m_acceptor->take(m_result);
+			}
+
+			bool await_suspend(std::coroutine_handle<> handle) noexcept
+			{
+				m_handle = handle;
+				return m_acceptor->wait(this);
+			}
+
+			Result await_resume() const noexcept
+			{
+				return m_result;
+			}
+
+		private:
+			friend class CoAcceptor;
+
+			CoAcceptor*             m_acceptor;
+			Result                  m_result;
+			std::coroutine_handle<> m_handle;
+		};
+
+		CoAcceptor() : m_waiter(NULL)
+		{}
+
+		~CoAcceptor()
+		{
+			m_acceptor = NULL;
+
+			Result r;
+			while (m_queue.pop(&r))
+			{
+				if (r.m_socket)
+					r.m_socket->release();
+			}
+		}
+
+		int bind(Proactor* proactor, const sockaddr* addr, socklen_t addr_len)
+		{
+			int err = 0;
+			m_acceptor = proactor->accept(this,&on_accept_addr,addr,addr_len,err);
+			return err;
+		}
+
+		int bind(Proactor* proactor, const char* path, SECURITY_ATTRIBUTES* psa = NULL)
+		{
+			int err = 0;
+			m_acceptor = proactor->accept(this,&on_accept,path,err,psa);
+			return err;
+		}
+
+		// Only one coroutine may be waiting at a time
+		AwaitAccept accept()
+		{
+			return AwaitAccept(this);
+		}
+
+	private:
+		SpinLock         m_lock;
+		RefPtr<Acceptor> m_acceptor;
+		Queue<Result>    m_queue;
+		AwaitAccept*     m_waiter;
+
+		bool take(Result& r)
+		{
+			Guard<SpinLock> guard(m_lock);
+			return m_queue.pop(&r);
+		}
+
+		bool wait(AwaitAccept* waiter)
+		{
+			Guard<SpinLock> guard(m_lock);
+
+			// Something may have arrived since await_ready()
+			if (m_queue.pop(&waiter->m_result))
+				return false;
+
+			m_waiter = waiter;
+			return true;
+		}
+
+		void deliver(AsyncSocket* pSocket, int err)
+		{
+			Result r = { pSocket, err };
+
+			Guard<SpinLock> guard(m_lock);
+
+			AwaitAccept* waiter = m_waiter;
+			m_waiter = NULL;
+
+			if (!waiter)
+			{
+				// The queue owns the socket now, unless it could not take it
+				if (!m_queue.push(r) && pSocket)
+					pSocket->release();
+				return;
+			}
+
+			guard.release();
+
+			waiter->m_result = r;
+			waiter->m_handle.resume();
+		}
+
+		static void on_accept(void* param, AsyncSocket* pSocket, int err)
+		{
+			static_cast<CoAcceptor*>(param)->deliver(pSocket,err);
+		}
+
+		static void on_accept_addr(void* param, AsyncSocket* pSocket, const sockaddr*, socklen_t, int err)
+		{
+			static_cast<CoAcceptor*>(param)->deliver(pSocket,err);
+		}
+	};
+
+	inline AwaitRecv async_recv(AsyncSocket* pSocket, const RefPtr<Buffer>& buffer, size_t bytes = 0)
+	{
+		return AwaitRecv(pSocket,buffer,bytes);
+	}
+
+	inline AwaitSend async_send(AsyncSocket* pSocket, const RefPtr<Buffer>& buffer)
+	{
+		return AwaitSend(pSocket,buffer);
+	}
+
+	inline AwaitSendV async_send_v(AsyncSocket* pSocket, Buffer* buffers[], size_t count)
+	{
+		return AwaitSendV(pSocket,buffers,count);
+	}
+
+	template <typename H>
+	inline AwaitRecvWithHeader<H> async_recv_with_header(AsyncSocket* pSocket, CDRStream& stream, size_t max_len = CDRStream::DefaultMaxFrame)
+	{
+		return AwaitRecvWithHeader<H>(pSocket,stream,max_len);
+	}
+}
+
+#endif // defined(__cpp_impl_coroutine)
+
+#endif // OOBASE_COROUTINE_H_INCLUDED_
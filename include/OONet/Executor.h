@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef OOSVRBASE_EXECUTOR_H_INCLUDED_
+#define OOSVRBASE_EXECUTOR_H_INCLUDED_
+
+#include "Proactor.h"
+#include "../OOBase/Thread.h"
+#include "../OOBase/Condition.h"
+#include "../OOBase/Atomic.h"
+
+namespace OOBase
+{
+	/// A pool of worker threads for CPU-heavy work that should not stall a Proactor loop.
+	/// Each worker keeps its own deque, popping its newest task first and stealing
+	/// the oldest task of another worker when its own deque is empty.
+	class Executor : public NonCopyable
+	{
+	public:
+		typedef void (*task_fn_t)(void* param);
+
+		// Opaque, see Executor.cpp
+		class Worker;
+
+		Executor();
+		~Executor();
+
+		// threads == 0 starts one worker per online CPU
+		int start(size_t threads = 0);
+
+		// Runs every queued task, then joins the workers.
+		// Queued tasks still post their done callbacks, so call stop() before stopping
+		// or destroying any Proactor passed to submit()
+		void stop();
+
+		// Runs fn(param) on a worker, a worker submitting to its own Executor queues locally
+		int submit(task_fn_t fn, void* param);
+
+		// Runs fn(param) on a worker, then done(param) on a thread in proactor->run()
+		int submit(task_fn_t fn, void* param, Proactor* proactor, task_fn_t done);
+
+	private:
+		struct Task
+		{
+			task_fn_t m_fn;
+			void*     m_param;
+			Proactor* m_proactor;
+			task_fn_t m_done;
+		};
+
+		ThreadPool       m_pool;
+		Worker**         m_workers;
+		size_t           m_worker_count;
+		size_t           m_started;
+		Atomic<size_t>   m_next_victim;
+		Atomic<size_t>   m_pending;
+		Condition::Mutex m_lock;       // Only taken to park a worker, or to wake a parked one
+		Condition        m_condition;
+		Atomic<size_t>   m_idle;       // Workers parked, or about to park, on m_condition
+		Atomic<size_t>   m_stopped;    // 1 while stopped, only changed by start() and stop()
+
+		int push(const Task& task);
+		bool pop(Worker* worker, Task& task);
+		static void execute(const Task& task);
+
+		static int run(void* param);
+	};
+}
+
+#endif // OOSVRBASE_EXECUTOR_H_INCLUDED_
@@ -36,6 +36,22 @@ typedef struct
 
 namespace OOBase
 {
+	/// Per-socket I/O counters, see AsyncSocket::get_stats()
+	struct AsyncSocketStats
+	{
+		uint64_t m_bytes_in;        ///< Bytes received
+		uint64_t m_bytes_out;       ///< Bytes sent
+		uint64_t m_syscalls;        ///< I/O system calls issued
+		uint64_t m_eagain;          ///< I/O system calls that would have blocked
+		size_t   m_recv_queue;      ///< Current number of pending receives
+		size_t   m_recv_queue_max;  ///< High-water mark of pending receives
+		size_t   m_send_queue;      ///< Current number of pending sends
+		size_t   m_send_queue_max;  ///< High-water mark of pending sends
+		uint64_t m_send_wait_usecs; ///< Total time spent waiting for the socket to become writable
+		size_t   m_send_queue_bytes; ///< Bytes in sends not yet completed
+		uint64_t m_recv_yields;     ///< Wakeups that gave way with data still to read, see Proactor::set_recv_budget()
+	};
+
 	class AsyncSocket : public RefCounted
 	{
 		friend class CDRIO;
@@ -116,6 +132,19 @@ namespace OOBase
 
 		virtual socket_t get_handle() const = 0;
 
+		// Counting is off by default, the queue depths are always maintained
+		virtual int enable_stats(bool enable) = 0;
+		virtual int get_stats(AsyncSocketStats& stats) = 0;
+
+		// See SocketOptions, not every transport supports every option
+		virtual int set_options(const SocketOptions& options) = 0;
+
+		// Bounds the bytes queued for sending: callback(param,true) is called once they reach high,
+		// and callback(param,false) once they drain to low. Sends are never refused, the producer
+		// is expected to hold back until told otherwise. A high of 0 turns watermarks off.
+		typedef void (*watermark_callback_t)(void* param, bool above_high);
+		virtual int set_watermarks(size_t high, size_t low, void* param, watermark_callback_t callback) = 0;
+
 	protected:
 		AsyncSocket() {}
 		virtual ~AsyncSocket() {}
@@ -241,6 +270,79 @@ namespace OOBase
 		virtual ~Acceptor() {}
 	};
 
+	/// A readiness watch on a file descriptor, see Proactor::watch(), release() to stop watching
+	class FdWatcher : public RefCounted
+	{
+	public:
+		enum Events
+		{
+			eRead = 1,
+			eWrite = 2
+		};
+
+		enum Mode
+		{
+			eOneShot,   ///< Fires once for each rearm()
+			ePersistent ///< Re-armed after each callback returns
+		};
+
+		// Arms the watch for events, needed after each callback of an eOneShot watcher
+		virtual int rearm(unsigned int events) = 0;
+
+	protected:
+		FdWatcher() {}
+		virtual ~FdWatcher() {}
+	};
+
+	/// A connectionless socket, each receive or send is exactly one datagram
+	class AsyncDatagramSocket : public RefCounted
+	{
+	public:
+		// The datagram is written at buffer->wr_ptr(), err is EMSGSIZE if it was truncated to fit
+		typedef void (*recv_from_callback_t)(void* param, const RefPtr<Buffer>& buffer, const sockaddr* addr, socklen_t addr_len, int err);
+		virtual int recv_from(void* param, recv_from_callback_t callback, const RefPtr<Buffer>& buffer) = 0;
+
+		// callback may be NULL
+		typedef void (*send_to_callback_t)(void* param, const RefPtr<Buffer>& buffer, int err);
+		virtual int send_to(void* param, send_to_callback_t callback, const RefPtr<Buffer>& buffer, const sockaddr* addr, socklen_t addr_len) = 0;
+
+		virtual socket_t get_handle() const = 0;
+
+		// Counting is off by default, the queue depths are always maintained
+		virtual int enable_stats(bool enable) = 0;
+		virtual int get_stats(AsyncSocketStats& stats) = 0;
+
+	protected:
+		AsyncDatagramSocket() {}
+		virtual ~AsyncDatagramSocket() {}
+	};
+
+	/// Event loop counters and histograms, see Proactor::get_stats()
+	struct ProactorStats
+	{
+		static const size_t HistogramBuckets = 32;
+
+		/// A log2 histogram, m_buckets[0] counts zeros, m_buckets[i] counts values in [2^(i-1),2^i)
+		struct Histogram
+		{
+			uint64_t m_count;
+			uint64_t m_sum;
+			uint64_t m_buckets[HistogramBuckets];
+		};
+
+		uint64_t  m_wakeups;           ///< Number of times the event wait returned
+		uint64_t  m_control_messages;  ///< Number of messages read from the control pipe
+		size_t    m_max_fds;           ///< High-water mark of watched handles
+		size_t    m_max_timers;        ///< High-water mark of pending timers
+		Histogram m_wait_usecs;        ///< Time spent blocked waiting for events
+		Histogram m_events_per_wakeup; ///< Number of ready handles per wakeup
+		Histogram m_callback_usecs;    ///< Time spent in I/O and timer callbacks
+		Histogram m_timer_late_usecs;  ///< How long after its due time each timer fired
+		uint64_t  m_busy_poll_hits;    ///< Busy-poll spins that found an event
+		uint64_t  m_busy_poll_misses;  ///< Busy-poll spins that ran out of budget
+		uint64_t  m_posts;             ///< Callbacks run for post()
+	};
+
 	class Proactor : public NonCopyable
 	{
 	public:
@@ -252,7 +354,8 @@ namespace OOBase
 		virtual Acceptor* accept(void* param, accept_pipe_callback_t callback, const char* path, int& err, SECURITY_ATTRIBUTES* psa = NULL) = 0;
 
 		typedef void (*accept_callback_t)(void* param, AsyncSocket* pSocket, const sockaddr* addr, socklen_t addr_len, int err);
-		virtual Acceptor* accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err) = 0;
+		// Accepted sockets inherit options, which are applied before their callback
+		virtual Acceptor* accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err, const SocketOptions* options = NULL) = 0;
 
 		virtual AsyncSocket* attach(socket_t sock, int& err) = 0;
 #if defined(_WIN32)
@@ -265,14 +368,53 @@ namespace OOBase
 		virtual Acceptor* wait_for_object(void* param, wait_object_callback_t callback, HANDLE hObject, int& err, ULONG dwMilliseconds = INFINITE) = 0;
 #endif
 
-		virtual AsyncSocket* connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout) = 0;
+		virtual AsyncSocket* connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout, const SocketOptions* options = NULL) = 0;
 		virtual AsyncSocket* connect(const char* path, int& err, const Timeout& timeout) = 0;
 
+		// Binds a SOCK_DGRAM socket to addr, attach_datagram() takes ownership of an already configured socket
+		virtual AsyncDatagramSocket* open_datagram(const sockaddr* addr, socklen_t addr_len, int& err) = 0;
+		virtual AsyncDatagramSocket* attach_datagram(socket_t sock, int& err) = 0;
+
+		// Same-host transport over shared memory rings, negotiated over a local socket at path
+		virtual Acceptor* accept_shared(void* param, accept_pipe_callback_t callback, const char* path, int& err, SECURITY_ATTRIBUTES* psa = NULL) = 0;
+		virtual AsyncSocket* connect_shared(const char* path, int& err, const Timeout& timeout, size_t ring_size = 0) = 0;
+
 		// Returns -1 on error, 0 on timeout, 1 on nothing more to do
 		virtual int run(int& err, const Timeout& timeout = Timeout()) = 0;
 		virtual void stop() = 0;
 		virtual int restart() = 0;
 
+		// Statistics gathering is off by default
+		virtual int enable_stats(bool enable) = 0;
+		virtual int get_stats(ProactorStats& stats, bool reset = false) = 0;
+
+		// Spin with zero-timeout waits for up to spin_usecs before blocking, 0 disables.
+		// The budget shrinks while spins find nothing, and grows again as events arrive.
+		// socket_busy_poll also sets SO_BUSY_POLL on sockets created from now on.
+		virtual int set_busy_poll(unsigned int spin_usecs, bool socket_busy_poll = false) = 0;
+
+		// Caps the bytes and recv calls one socket may use per wakeup, 0 is unlimited.
+		// A socket that runs out re-arms itself and lets the others run first.
+		virtual int set_recv_budget(size_t bytes, size_t ops) = 0;
+
+		// Runs callback(param) on a thread in run(), from any thread and without blocking.
+		// Callbacks posted by one thread run in the order they were posted, one batch at a
+		// time on Posix. On Win32 that only holds with a single thread in run().
+		typedef void (*post_callback_t)(void* param);
+		virtual int post(void* param, post_callback_t callback) = 0;
+
+		// Calls callback when fd is ready for FdWatcher::Events, the caller still owns fd.
+		// An error or hang-up is reported as every watched event being ready.
+		// The watcher may be released from its callback, or while no callback is running.
+		typedef void (*watch_callback_t)(void* param, int fd, unsigned int events, int err);
+		virtual FdWatcher* watch(void* param, watch_callback_t callback, int fd, unsigned int events, FdWatcher::Mode mode, int& err) = 0;
+
+		// Calls callback(param) on a thread in run() once timeout expires, param identifies the timer.
+		// The timer is restarted with the Timeout the callback returns, unless it is infinite.
+		typedef Timeout (*timer_callback_t)(void* param);
+		virtual int start_timer(void* param, timer_callback_t callback, const Timeout& timeout) = 0;
+		virtual int stop_timer(void* param) = 0;
+
 	protected:
 		Proactor() {}
 		virtual ~Proactor() {}
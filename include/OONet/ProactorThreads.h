@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef OOSVRBASE_PROACTOR_THREADS_H_INCLUDED_
+#define OOSVRBASE_PROACTOR_THREADS_H_INCLUDED_
+
+#include "Proactor.h"
+#include "../OOBase/Thread.h"
+#include "../OOBase/Mutex.h"
+
+namespace OOBase
+{
+	/// Runs Proactor::run() on a pool of managed threads, optionally pinned to CPUs or NUMA nodes.
+	/// Every thread runs the same Proactor, so any thread may complete any socket's I/O:
+	/// pinning only stops the threads migrating, it does not keep a socket's work or memory on one node.
+	/// For per-node locality run one Proactor, with its own ProactorThreads, per node.
+	class ProactorThreads : public NonCopyable
+	{
+	public:
+		enum Affinity
+		{
+			eAffinityNone = 0,
+			eAffinityCPU,   ///< ids are logical CPU numbers
+			eAffinityNode   ///< ids are NUMA node numbers, the thread may run on any CPU of the node
+		};
+
+		ProactorThreads(Proactor* proactor);
+		~ProactorThreads();
+
+		// Thread i is pinned to ids[i % count], call before start()
+		int set_affinity(Affinity affinity, const unsigned int* ids, size_t count);
+
+		// threads == 0 starts one thread per online CPU
+		int start(size_t threads = 0);
+
+		// Stops the Proactor and waits for every thread to leave run(), returns the first error
+		int stop();
+
+		size_t size() const
+		{
+			return m_threads;
+		}
+
+		// The number of online CPUs, at least 1
+		static size_t cpu_count();
+
+	private:
+		Proactor*      m_proactor;
+		ThreadPool     m_pool;
+		Affinity       m_affinity;
+		unsigned int*  m_ids;
+		size_t         m_id_count;
+		size_t         m_threads;
+		SpinLock       m_lock;
+		size_t         m_next;
+		int            m_err;
+
+		static int run(void* param);
+		int pin(unsigned int id);
+	};
+}
+
+#endif // OOSVRBASE_PROACTOR_THREADS_H_INCLUDED_
@@ -0,0 +1,416 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef OOBASE_RPC_CHANNEL_H_INCLUDED_
+#define OOBASE_RPC_CHANNEL_H_INCLUDED_
+
+#include "AsyncResponse.h"
+#include "Proactor.h"
+#include "Vector.h"
+
+namespace OOBase
+{
+	/// A pipelined request/response channel over a single AsyncSocket.
+	/**
+	 *  Every frame on the wire is a length of type \p L, followed by a handle of type \p H,
+	 *  followed by the payload, padded to CDRStream::MaxAlignment.  Requests are queued
+	 *  and written in batches with a single send_v(), and replies are matched to their
+	 *  callbacks by handle using an AsyncResponseDispatcher, so any number of requests
+	 *  may be outstanding at once.
+	 *
+	 *  call() takes the request buffer from the stream it is passed and gives the stream a
+	 *  fresh one, so the stream can be reused as soon as call() returns.
+	 *
+	 *  Reply callbacks are called on the Proactor thread, and the CDRStream they are passed
+	 *  is only valid for the duration of the callback.  If the channel fails, all
+	 *  outstanding callbacks are called with an empty stream.
+	 *
+	 *  A reply frame longer than \p max_frame, a reply with an unknown or already answered
+	 *  handle, or a reply whose callback returns false, fails the channel with a protocol error.
+	 */
+	template <typename H, typename L = uint32_t, size_t Shards = 1>
+	class RPCChannel : public RefCounted
+	{
+	public:
+		static RPCChannel* create(AsyncSocket* pSocket, int& err, size_t recv_buffer_size = 4096, size_t max_frame = CDRStream::DefaultMaxFrame)
+		{
+			RPCChannel* pChannel = NULL;
+			if (!pSocket)
+				err = EINVAL;
+			else if (!CrtAllocator::allocate_new(pChannel,pSocket,recv_buffer_size,max_frame))
+				err = ERROR_OUTOFMEMORY;
+			else
+			{
+				err = pChannel->start();
+				if (err)
+				{
+					pChannel->release();
+					pChannel = NULL;
+				}
+			}
+			return pChannel;
+		}
+
+		/// Write a placeholder frame header into \p stream, call before writing the request payload.
+		static bool begin_request(CDRStream& stream)
+		{
+			stream.reset();
+			return stream.write(L(0)) && stream.write(H(0));
+		}
+
+		template <typename T>
+		int call(CDRStream& stream, T* pThis, bool (T::*callback)(CDRStream&))
+		{
+			H handle = 0;
+			if (!m_dispatcher.add_response(pThis,callback,handle))
+				return ERROR_OUTOFMEMORY;
+
+			return send_request(stream,handle);
+		}
+
+		template <typename T, typename P1, typename PP1>
+		int call(CDRStream& stream, T* pThis, bool (T::*callback)(CDRStream&, P1 p1), PP1 p1)
+		{
+			H handle = 0;
+			if (!m_dispatcher.add_response(pThis,callback,p1,handle))
+				return ERROR_OUTOFMEMORY;
+
+			return send_request(stream,handle);
+		}
+
+		template <typename T, typename P1, typename P2, typename PP1, typename PP2>
+		int call(CDRStream& stream, T* pThis, bool (T::*callback)(CDRStream&, P1 p1, P2 p2), PP1 p1, PP2 p2)
+		{
+			H handle = 0;
+			if (!m_dispatcher.add_response(pThis,callback,p1,p2,handle))
+				return ERROR_OUTOFMEMORY;
+
+			return send_request(stream,handle);
+		}
+
+		template <typename T, typename P1, typename P2, typename P3, typename PP1, typename PP2, typename PP3>
+		int call(CDRStream& stream, T* pThis, bool (T::*callback)(CDRStream&, P1 p1, P2 p2, P3 p3), PP1 p1, PP2 p2, PP3 p3)
+		{
+			H handle = 0;
+			if (!m_dispatcher.add_response(pThis,callback,p1,p2,p3,handle))
+				return ERROR_OUTOFMEMORY;
+
+			return send_request(stream,handle);
+		}
+
+		int last_error()
+		{
+			Guard<Mutex> guard(m_lock);
+
+			return m_last_error;
+		}
+
+		int shutdown()
+		{
+			return m_ptrSocket->shutdown(true,true);
+		}
+
+		RPCChannel(AsyncSocket* pSocket, size_t recv_buffer_size, size_t max_frame) :
+				m_ptrSocket(pSocket),
+				m_recv_size(recv_buffer_size),
+				m_recv_have(0),
+				m_max_frame(max_frame),
+				m_sending(false),
+				m_last_error(0)
+		{
+			pSocket->addref();
+		}
+
+		~RPCChannel()
+		{
+			for (size_t i = 0; i < m_pending.size(); ++i)
+				(*m_pending.at(i))->release();
+		}
+
+	private:
+		void destroy()
+		{
+			CrtAllocator::delete_free(this);
+		}
+
+		RefPtr<AsyncSocket>                            m_ptrSocket;
+		AsyncResponseDispatcher<H,CrtAllocator,Shards> m_dispatcher;
+		Mutex                                          m_lock;
+		RefPtr<Buffer>                                 m_recv_buffer;
+		size_t                                         m_recv_size;
+		size_t                                         m_recv_have;
+		size_t                                         m_max_frame;
+		Vector<Buffer*>                                m_pending;
+		bool                                           m_sending;
+		int                                            m_last_error;
+
+		static size_t handle_mark()
+		{
+			return (sizeof(L) + alignment_of<H>::value - 1) & ~(alignment_of<H>::value - 1);
+		}
+
+		static int error_protocol()
+		{
+#if defined(_WIN32)
+			return ERROR_INVALID_DATA;
+#else
+			return EPROTO;
+#endif
+		}
+
+		static int error_closed()
+		{
+#if defined(_WIN32)
+			return ERROR_BROKEN_PIPE;
+#else
+			return EPIPE;
+#endif
+		}
+
+		int send_request(CDRStream& stream, H handle)
+		{
+			int err = stream.last_error();
+			if (!err && stream.length() < handle_mark() + sizeof(H))
+				err = EINVAL;
+
+			// Pad so that the next frame of a batch starts correctly aligned
+			if (!err)
+				err = stream.buffer()->align_wr_ptr(CDRStream::MaxAlignment);
+
+			if (!err)
+			{
+				stream.replace(handle,handle_mark());
+				stream.replace(static_cast<L>(stream.length()),0);
+				err = stream.last_error();
+			}
+
+			// The frame may sit in m_pending or be mid-send long after we return,
+			// so take it from the stream rather than share it with the caller
+			RefPtr<Buffer> frame;
+			if (!err)
+			{
+				RefPtr<Buffer> fresh = Buffer::create(stream.length(),CDRStream::MaxAlignment);
+				if (!fresh)
+					err = ERROR_OUTOFMEMORY;
+				else
+				{
+					frame = stream.buffer();
+					stream.buffer() = fresh;
+				}
+			}
+
+			if (!err)
+				err = queue_send(frame.get());
+
+			if (err)
+				m_dispatcher.cancel_response(handle);
+
+			return err;
+		}
+
+		int queue_send(Buffer* buffer)
+		{
+			Guard<Mutex> guard(m_lock);
+
+			if (m_last_error)
+				return m_last_error;
+
+			if (!m_pending.push_back(buffer))
+				return ERROR_OUTOFMEMORY;
+
+			buffer->addref();
+
+			if (m_sending)
+				return 0;
+
+			m_sending = true;
+			return flush(guard);
+		}
+
+		// Called with m_lock held, returns with it released
+		int flush(Guard<Mutex>& guard)
+		{
+			size_t count = m_pending.size();
+
+			ScopedArrayPtr<Buffer*> buffers(count);
+			if (!buffers)
+			{
+				m_sending = false;
+				guard.release();
+				return ERROR_OUTOFMEMORY;
+			}
+
+			for (size_t i = 0; i < count; ++i)
+				buffers[i] = *m_pending.at(i);
+			m_pending.clear();
+
+			guard.release();
+
+			addref();
+
+			int err = m_ptrSocket->send_v(this,&RPCChannel::on_sent,buffers.get(),count);
+
+			for (size_t i = 0; i < count; ++i)
+				buffers[i]->release();
+
+			if (err)
+			{
+				guard.acquire();
+				m_sending = false;
+
+				guard.release();
+
+				release();
+			}
+
+			return err;
+		}
+
+		void on_sent(Buffer* /*buffers*/[], size_t /*count*/, int err)
+		{
+			Guard<Mutex> guard(m_lock);
+
+			if (err && !m_last_error)
+				m_last_error = err;
+
+			if (!m_last_error && !m_pending.empty())
+			{
+				// Send everything queued while we were busy as the next batch
+				err = flush(guard);
+				if (err)
+				{
+					guard.acquire();
+					if (!m_last_error)
+						m_last_error = err;
+					guard.release();
+				}
+			}
+			else
+			{
+				m_sending = false;
+				guard.release();
+			}
+
+			if (err)
+				fail();
+
+			release();
+		}
+
+		int start()
+		{
+			m_recv_buffer = Buffer::create(m_recv_size,CDRStream::MaxAlignment);
+			if (!m_recv_buffer)
+				return ERROR_OUTOFMEMORY;
+
+			return recv_next();
+		}
+
+		int recv_next()
+		{
+			m_recv_have = m_recv_buffer->length();
+
+			addref();
+
+			int err = m_ptrSocket->recv(this,&RPCChannel::on_recv,m_recv_buffer,0);
+			if (err)
+				release();
+
+			return err;
+		}
+
+		void on_recv(const RefPtr<Buffer>& buffer, int err)
+		{
+			if (!err && buffer->length() == m_recv_have)
+				err = error_closed();
+
+			size_t need = 0;
+			while (!err && buffer->length() >= sizeof(L))
+			{
+				size_t frame_start = buffer->mark_rd_ptr();
+				size_t avail = buffer->length();
+
+				CDRStream stream(buffer);
+				L frame_len = 0;
+				if (!stream.read(frame_len))
+					err = stream.last_error();
+				else if (frame_len < handle_mark() + sizeof(H) || frame_len > m_max_frame)
+					err = error_protocol();
+				else if (avail < frame_len)
+				{
+					// Incomplete frame, wait for the rest
+					buffer->mark_rd_ptr(frame_start);
+					need = frame_len;
+					break;
+				}
+				else
+				{
+					// Limit the reply to its own frame while it is dispatched
+					size_t frame_end = frame_start + frame_len;
+					size_t wr_mark = buffer->mark_wr_ptr();
+					buffer->mark_wr_ptr(frame_end);
+
+					if (!m_dispatcher.handle_response(stream))
+						err = error_protocol();
+
+					buffer->mark_wr_ptr(wr_mark);
+					buffer->mark_rd_ptr(frame_end);
+				}
+			}
+
+			if (!err)
+			{
+				// Move any partial frame back to the (aligned) start of the buffer
+				buffer->compact();
+
+				size_t want = (need > buffer->length() ? need - buffer->length() : 0);
+				if (want < m_recv_size / 2)
+					want = m_recv_size / 2;
+
+				err = buffer->space(want);
+				if (!err)
+					err = recv_next();
+			}
+
+			if (err)
+			{
+				Guard<Mutex> guard(m_lock);
+				if (!m_last_error)
+					m_last_error = err;
+
+				guard.release();
+
+				fail();
+			}
+
+			release();
+		}
+
+		void fail()
+		{
+			m_ptrSocket->shutdown(true,true);
+			m_dispatcher.drop_all();
+		}
+	};
+}
+
+#endif // OOBASE_RPC_CHANNEL_H_INCLUDED_
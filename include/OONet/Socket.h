@@ -62,6 +62,29 @@ namespace OOBase
 	typedef int socket_t;
 #endif
 
+	/// TCP and buffer tuning, zeroed members leave the system defaults alone
+	struct SocketOptions
+	{
+		enum Switch
+		{
+			eDefault = 0,
+			eOn,
+			eOff
+		};
+
+		Switch m_nodelay;            ///< TCP_NODELAY, disables Nagle's algorithm
+		Switch m_keepalive;          ///< SO_KEEPALIVE
+		Switch m_quickack;           ///< TCP_QUICKACK, an AsyncSocket re-applies it after each receive
+		Switch m_cork;               ///< Cork an AsyncSocket while it has sends queued, so batches leave as full segments
+		int    m_sndbuf;             ///< SO_SNDBUF in bytes
+		int    m_rcvbuf;             ///< SO_RCVBUF in bytes, applied before connect or listen so window scaling sees it
+		int    m_notsent_lowat;      ///< TCP_NOTSENT_LOWAT in bytes
+		int    m_keepalive_idle;     ///< Seconds idle before the first keep-alive probe
+		int    m_keepalive_interval; ///< Seconds between keep-alive probes
+		int    m_keepalive_count;    ///< Unanswered probes before the connection drops
+		int    m_backlog;            ///< listen() backlog of an acceptor, 0 for SOMAXCONN
+	};
+
 	namespace Net
 	{
 		socket_t open_socket(int family, int type, int protocol, int& err);
@@ -70,6 +93,9 @@ namespace OOBase
 		int connect(socket_t sock, const sockaddr* addr, socklen_t addrlen, const Timeout& timeout = Timeout());
 		int accept(socket_t accept_sock, socket_t& new_sock, const Timeout& timeout = Timeout());
 
+		// Applies all but m_cork and m_backlog, which belong to AsyncSocket and acceptors
+		int set_options(socket_t sock, const SocketOptions& options);
+
 #if defined(_WIN32)
 		int accept(HANDLE hPipe, const Timeout& timeout = Timeout());
 #endif
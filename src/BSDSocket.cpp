@@ -32,6 +32,8 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #if !defined(MSG_NOSIGNAL)
 #if (defined(__APPLE__) || defined(__MACH__))
@@ -255,6 +257,76 @@ int OOBase::Net::accept(socket_t accept_sock, socket_t& new_sock, const Timeout&
 	return err;
 }
 
+namespace
+{
+	int set_int_option(int sock, int level, int name, int val)
+	{
+		return (::setsockopt(sock,level,name,&val,sizeof(val)) != 0 ? errno : 0);
+	}
+
+	int set_switch_option(int sock, int level, int name, OOBase::SocketOptions::Switch val)
+	{
+		return (val == OOBase::SocketOptions::eDefault ? 0 : set_int_option(sock,level,name,val == OOBase::SocketOptions::eOn ? 1 : 0));
+	}
+}
+
+int OOBase::Net::set_options(socket_t sock, const SocketOptions& options)
+{
+	int err = set_switch_option(sock,IPPROTO_TCP,TCP_NODELAY,options.m_nodelay);
+	if (!err)
+		err = set_switch_option(sock,SOL_SOCKET,SO_KEEPALIVE,options.m_keepalive);
+	if (!err && options.m_sndbuf)
+		err = set_int_option(sock,SOL_SOCKET,SO_SNDBUF,options.m_sndbuf);
+	if (!err && options.m_rcvbuf)
+		err = set_int_option(sock,SOL_SOCKET,SO_RCVBUF,options.m_rcvbuf);
+
+#if defined(TCP_QUICKACK)
+	if (!err)
+		err = set_switch_option(sock,IPPROTO_TCP,TCP_QUICKACK,options.m_quickack);
+#else
+	if (!err && options.m_quickack == SocketOptions::eOn)
+		err = ENOTSUP;
+#endif
+
+#if defined(TCP_NOTSENT_LOWAT)
+	if (!err && options.m_notsent_lowat)
+		err = set_int_option(sock,IPPROTO_TCP,TCP_NOTSENT_LOWAT,options.m_notsent_lowat);
+#else
+	if (!err && options.m_notsent_lowat)
+		err = ENOTSUP;
+#endif
+
+	// macOS calls TCP_KEEPIDLE TCP_KEEPALIVE
+#if defined(TCP_KEEPIDLE)
+	if (!err && options.m_keepalive_idle)
+		err = set_int_option(sock,IPPROTO_TCP,TCP_KEEPIDLE,options.m_keepalive_idle);
+#elif defined(TCP_KEEPALIVE)
+	if (!err && options.m_keepalive_idle)
+		err = set_int_option(sock,IPPROTO_TCP,TCP_KEEPALIVE,options.m_keepalive_idle);
+#else
+	if (!err && options.m_keepalive_idle)
+		err = ENOTSUP;
+#endif
+
+#if defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+	if (!err && options.m_keepalive_interval)
+		err = set_int_option(sock,IPPROTO_TCP,TCP_KEEPINTVL,options.m_keepalive_interval);
+	if (!err && options.m_keepalive_count)
+		err = set_int_option(sock,IPPROTO_TCP,TCP_KEEPCNT,options.m_keepalive_count);
+#else
+	if (!err && (options.m_keepalive_interval || options.m_keepalive_count))
+		err = ENOTSUP;
+#endif
+
+	// Corking is done by AsyncSocket, but fail early if it cannot be
+#if !defined(TCP_CORK) && !defined(TCP_NOPUSH)
+	if (!err && options.m_cork == SocketOptions::eOn)
+		err = ENOTSUP;
+#endif
+
+	return err;
+}
+
 namespace
 {
 	class BSDSocket : public OOBase::Socket
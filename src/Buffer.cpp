@@ -42,10 +42,26 @@ OOBase::Buffer::Buffer(uint8_t* buffer, size_t cbSize, size_t align) :
 		m_capacity(cbSize),
 		m_align(align),
 		m_wr_ptr(buffer),
-		m_rd_ptr(buffer)
+		m_rd_ptr(buffer),
+		m_read_only(false)
 {
 }
 
+OOBase::Buffer::Buffer(const uint8_t* buffer, size_t cbSize) :
+		m_buffer(const_cast<uint8_t*>(buffer)),
+		m_capacity(cbSize),
+		m_align(1),
+		m_wr_ptr(m_buffer + cbSize),
+		m_rd_ptr(m_buffer),
+		m_read_only(true)
+{
+}
+
+bool OOBase::Buffer::read_only() const
+{
+	return m_read_only;
+}
+
 const OOBase::uint8_t* OOBase::Buffer::rd_ptr() const
 {
 	return m_rd_ptr;
@@ -88,7 +104,8 @@ size_t OOBase::Buffer::mark_wr_ptr() const
 
 void OOBase::Buffer::mark_wr_ptr(size_t mark)
 {
-	m_wr_ptr = (m_buffer + mark);
+	if (!m_read_only)
+		m_wr_ptr = (m_buffer + mark);
 }
 
 int OOBase::Buffer::wr_ptr(size_t cbExpand)
@@ -123,11 +140,17 @@ size_t OOBase::Buffer::length() const
 
 void OOBase::Buffer::reset()
 {
-	m_rd_ptr = m_wr_ptr = m_buffer;
+	if (m_read_only)
+		m_rd_ptr = m_wr_ptr;
+	else
+		m_rd_ptr = m_wr_ptr = m_buffer;
 }
 
 void OOBase::Buffer::compact()
 {
+	if (m_read_only)
+		return;
+
 	uint8_t* orig_rd = m_rd_ptr;
 	ptrdiff_t len = (m_wr_ptr - m_rd_ptr);
 
@@ -157,6 +180,9 @@ int OOBase::Buffer::space(size_t cbSpace)
 	size_t cbAbsCapacity = (m_wr_ptr - m_buffer) + cbSpace;
 	if (cbAbsCapacity > m_capacity)
 	{
+		if (m_read_only)
+			return ERROR_OUTOFMEMORY;
+
 		size_t rd_pos = (m_rd_ptr - m_buffer);
 		size_t wr_pos = (m_wr_ptr - m_buffer);
 
@@ -0,0 +1,328 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#include "../include/OOBase/Executor.h"
+#include "../include/OOBase/ProactorThreads.h"
+
+#if defined(_MSC_VER)
+#define EXECUTOR_THREAD_LOCAL __declspec(thread)
+#else
+#define EXECUTOR_THREAD_LOCAL __thread
+#endif
+
+#include <string.h>
+
+// A deque guarded by a SpinLock, the owner uses the back and thieves the front
+class OOBase::Executor::Worker : public NonCopyable
+{
+public:
+	Worker(Executor* executor, size_t index) :
+			m_executor(executor),
+			m_index(index),
+			m_tasks(NULL),
+			m_capacity(0),
+			m_head(0),
+			m_tail(0)
+	{}
+
+	~Worker()
+	{
+		CrtAllocator::free(m_tasks);
+	}
+
+	Executor* executor() const
+	{
+		return m_executor;
+	}
+
+	size_t index() const
+	{
+		return m_index;
+	}
+
+	bool push_back(const Task& task)
+	{
+		Guard<SpinLock> guard(m_lock);
+
+		if (m_tail - m_head == m_capacity && !grow())
+			return false;
+
+		m_tasks[m_tail++ & (m_capacity - 1)] = task;
+		return true;
+	}
+
+	bool pop_back(Task& task)
+	{
+		Guard<SpinLock> guard(m_lock);
+
+		if (m_tail == m_head)
+			return false;
+
+		task = m_tasks[--m_tail & (m_capacity - 1)];
+		return true;
+	}
+
+	bool steal_front(Task& task)
+	{
+		Guard<SpinLock> guard(m_lock);
+
+		if (m_tail == m_head)
+			return false;
+
+		task = m_tasks[m_head++ & (m_capacity - 1)];
+		return true;
+	}
+
+private:
+	Executor* m_executor;
+	size_t    m_index;
+	SpinLock  m_lock;
+	Task*     m_tasks;
+	size_t    m_capacity;
+	size_t    m_head;
+	size_t    m_tail;
+
+	bool grow()
+	{
+		size_t new_capacity = (m_capacity ? m_capacity * 2 : 64);
+		Task* new_tasks = static_cast<Task*>(CrtAllocator::allocate(new_capacity * sizeof(Task),alignment_of<Task>::value));
+		if (!new_tasks)
+			return false;
+
+		// Unwrap into the new ring
+		for (size_t i = m_head; i != m_tail; ++i)
+			new_tasks[i - m_head] = m_tasks[i & (m_capacity - 1)];
+
+		CrtAllocator::free(m_tasks);
+		m_tasks = new_tasks;
+		m_tail -= m_head;
+		m_head = 0;
+		m_capacity = new_capacity;
+		return true;
+	}
+};
+
+namespace
+{
+	EXECUTOR_THREAD_LOCAL OOBase::Executor::Worker* s_current_worker = NULL;
+}
+
+OOBase::Executor::Executor() :
+		m_workers(NULL),
+		m_worker_count(0),
+		m_started(0),
+		m_next_victim(0),
+		m_pending(0),
+		m_idle(0),
+		m_stopped(1)
+{
+}
+
+OOBase::Executor::~Executor()
+{
+	stop();
+}
+
+int OOBase::Executor::start(size_t threads)
+{
+	if (m_workers)
+		return EBUSY;
+
+	if (!threads)
+		threads = ProactorThreads::cpu_count();
+
+	m_workers = static_cast<Worker**>(CrtAllocator::allocate(threads * sizeof(Worker*),alignment_of<Worker*>::value));
+	if (!m_workers)
+		return ERROR_OUTOFMEMORY;
+
+	for (m_worker_count = 0; m_worker_count < threads; ++m_worker_count)
+	{
+		if (!CrtAllocator::allocate_new(m_workers[m_worker_count],this,m_worker_count))
+		{
+			stop();
+			return ERROR_OUTOFMEMORY;
+		}
+	}
+
+	--m_stopped;
+
+	int err = m_pool.run(&run,this,threads);
+	if (err)
+		stop();
+
+	return err;
+}
+
+void OOBase::Executor::stop()
+{
+	if (!m_workers)
+		return;
+
+	if (!m_stopped)
+		++m_stopped;
+
+	// Taking the lock orders the broadcast after any worker's check of m_stopped
+	Guard<Condition::Mutex> guard(m_lock);
+	m_condition.broadcast();
+	guard.release();
+
+	m_pool.join();
+
+	for (size_t i = 0; i < m_worker_count; ++i)
+		CrtAllocator::delete_free(m_workers[i]);
+
+	CrtAllocator::free(m_workers);
+	m_workers = NULL;
+	m_worker_count = 0;
+	m_started = 0;
+}
+
+int OOBase::Executor::submit(task_fn_t fn, void* param)
+{
+	if (!fn)
+		return EINVAL;
+
+	Task task = { fn, param, NULL, NULL };
+	return push(task);
+}
+
+int OOBase::Executor::submit(task_fn_t fn, void* param, Proactor* proactor, task_fn_t done)
+{
+	if (!fn || !proactor || !done)
+		return EINVAL;
+
+	Task task = { fn, param, proactor, done };
+	return push(task);
+}
+
+int OOBase::Executor::push(const Task& task)
+{
+	if (!m_workers)
+		return EINVAL;
+
+	// Workers keep their own work, other threads spread it round the workers
+	Worker* worker = s_current_worker;
+	if (!worker || worker->executor() != this)
+	{
+		// Only tasks already running may add work once stop() has been called
+		if (m_stopped)
+			return EINVAL;
+
+		worker = m_workers[m_next_victim++ % m_worker_count];
+	}
+
+	++m_pending;
+	if (!worker->push_back(task))
+	{
+		--m_pending;
+		return ERROR_OUTOFMEMORY;
+	}
+
+	// m_pending was raised first, so a worker that is not yet counted in m_idle will see the task
+	if (m_idle)
+	{
+		Guard<Condition::Mutex> guard(m_lock);
+		m_condition.signal();
+	}
+
+	return 0;
+}
+
+bool OOBase::Executor::pop(Worker* worker, Task& task)
+{
+	if (worker->pop_back(task))
+		return true;
+
+	// Steal the oldest task of another worker, starting from a neighbour
+	size_t self = worker->index();
+	for (size_t i = 1; i < m_worker_count; ++i)
+	{
+		if (m_workers[(self + i) % m_worker_count]->steal_front(task))
+			return true;
+	}
+
+	return false;
+}
+
+void OOBase::Executor::execute(const Task& task)
+{
+	(*task.m_fn)(task.m_param);
+
+	if (task.m_done)
+	{
+		// Hand the result back to the Proactor's loop
+		int err = task.m_proactor->post(task.m_param,task.m_done);
+		if (err)
+			OOBase_CallCriticalFailure(err);
+	}
+}
+
+int OOBase::Executor::run(void* param)
+{
+	Executor* pThis = static_cast<Executor*>(param);
+
+	Guard<Condition::Mutex> guard(pThis->m_lock);
+	Worker* worker = pThis->m_workers[pThis->m_started++];
+	guard.release();
+
+	s_current_worker = worker;
+
+	for (;;)
+	{
+		Task task;
+		if (pThis->pop(worker,task))
+		{
+			--pThis->m_pending;
+			execute(task);
+			continue;
+		}
+
+		guard.acquire();
+
+		// Count this worker as idle before checking m_pending, so a racing push()
+		// either sees it and signals, or this check sees the new task
+		++pThis->m_idle;
+		if (pThis->m_pending == 0)
+		{
+			// Drain everything before honouring stop()
+			if (pThis->m_stopped)
+			{
+				--pThis->m_idle;
+				break;
+			}
+
+			pThis->m_condition.wait(pThis->m_lock);
+			--pThis->m_idle;
+			guard.release();
+		}
+		else
+		{
+			// A task is counted but not yet visible in a deque
+			--pThis->m_idle;
+			guard.release();
+			Thread::yield();
+		}
+	}
+
+	s_current_worker = NULL;
+	return 0;
+}
@@ -19,6 +19,11 @@
 //
 ///////////////////////////////////////////////////////////////////////////////////
 
+// ppoll() is a GNU extension
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "../include/OOBase/Posix.h"
 
 #include "ProactorPoll.h"
@@ -77,7 +82,17 @@ int OOBase::detail::ProactorPoll::init()
 
 	// Add the control pipe to m_poll_fds
 	pollfd pfd = { m_read_fd, POLLIN | POLLRDHUP, 0 };
-	return m_poll_fds.push_back(pfd) ? 0 : ERROR_OUTOFMEMORY;
+	if (!m_poll_fds.push_back(pfd))
+		return ERROR_OUTOFMEMORY;
+
+	// And the post() eventfd, if there is one
+	if (m_post_fd != -1)
+	{
+		pollfd post_pfd = { m_post_fd, POLLIN, 0 };
+		if (!m_poll_fds.push_back(post_pfd))
+			return ERROR_OUTOFMEMORY;
+	}
+	return 0;
 }
 
 bool OOBase::detail::ProactorPoll::do_bind_fd(int fd, void* param, fd_callback_t callback)
@@ -164,6 +179,16 @@ bool OOBase::detail::ProactorPoll::update_fds(FdEvent& active_fd, int poll_count
 				continue;
 			}
 
+			// The queue itself is drained by run()
+			if (pfd->fd == m_post_fd)
+			{
+				err = read_post_fd();
+				if (err)
+					return false;
+
+				continue;
+			}
+
 			// Find the corresponding FdItem
 			OOBase::HashTable<int,FdItem,AllocatorInstance>::iterator i = m_items.find(pfd->fd);
 			if (i)
@@ -234,23 +259,111 @@ bool OOBase::detail::ProactorPoll::update_fds(FdEvent& active_fd, int poll_count
     return false;
 }
 
+int OOBase::detail::ProactorPoll::wait(nfds_t count, const Timeout& timeout)
+{
+#if defined(HAVE_PPOLL)
+	// ppoll() takes a timespec, so timers are not rounded to whole milliseconds
+	timespec ts = {0};
+	timespec* pts = NULL;
+	timeval tv;
+	if (!timeout.is_infinite() && timeout.get_timeval(tv))
+	{
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000;
+		pts = &ts;
+	}
+
+	return ::ppoll(m_poll_fds.at(0),count,pts,NULL);
+#else
+	return ::poll(m_poll_fds.at(0),count,timeout.millisecs());
+#endif
+}
+
+int OOBase::detail::ProactorPoll::spin_poll(unsigned int& budget, unsigned int limit, const Timeout& timeout, ProactorStats* stats)
+{
+	// Poll without sleeping until something happens or the budget runs out
+	uint64_t start = stats_clock();
+	int count = 0;
+	do
+	{
+		count = ::poll(m_poll_fds.at(0),m_poll_fds.size(),0);
+	}
+	while (count == 0 && stats_clock() - start < budget && !timeout.has_expired());
+
+	if (count > 0)
+	{
+		// Spinning paid off, allow the full budget next time
+		budget = limit;
+		if (stats)
+			stats_inc(stats->m_busy_poll_hits);
+	}
+	else if (count == 0)
+	{
+		// Back off, so an idle loop soon goes straight to a blocking wait
+		budget /= 2;
+		if (stats)
+			stats_inc(stats->m_busy_poll_misses);
+	}
+
+	return count;
+}
+
 int OOBase::detail::ProactorPoll::run(int& err, const Timeout& timeout)
 {
+	StatsScope stats_scope(this);
+
 	Guard<Mutex> guard(m_lock);
 
+	// The adaptive busy-poll budget of this thread
+	unsigned int spin_budget = busy_poll_usecs();
+
+	// Set when the last batch of posts was full, so there may be more waiting
+	bool more_posts = false;
+
 	while (!m_stopped && !timeout.has_expired())
 	{
 		TimerItem active_timer;
 		FdEvent active_fd;
 		bool fd_event = false;
+		ProactorStats* stats = stats_scope.get();
 
 		// Check timers and update timeout
 		Timeout local_timeout(timeout);
 		bool timer_event = check_timers(active_timer,local_timeout);
+		if (more_posts)
+			local_timeout = Timeout(0,0);
+
 		if (!timer_event)
 		{
-			// If no timers have expired, poll for I/O
-			int count = ::poll(m_poll_fds.at(0),m_poll_fds.size(),local_timeout.millisecs());
+			if (stats)
+				stats_high_water(m_stats_max_fds,m_poll_fds.size());
+
+			uint64_t wait_start = (stats ? stats_clock() : 0);
+
+			unsigned int spin_limit = busy_poll_usecs();
+			if (spin_budget > spin_limit)
+				spin_budget = spin_limit;
+
+			// If no timers have expired, poll for I/O, spinning first if enabled
+			int count = 0;
+			if (spin_budget && !more_posts)
+				count = spin_poll(spin_budget,spin_limit,local_timeout,stats);
+
+			if (count == 0)
+			{
+				count = wait(m_poll_fds.size(),local_timeout);
+				if (count > 0 && spin_limit)
+				{
+					// Events are arriving again, so grow the budget back towards the limit
+					if (spin_budget < spin_limit / 16)
+						spin_budget = spin_limit / 16 + 1;
+					else if (spin_budget < spin_limit / 2)
+						spin_budget *= 2;
+					else
+						spin_budget = spin_limit;
+				}
+			}
+
 			if (count == -1)
 			{
 				if (errno == EINVAL)
@@ -260,7 +373,7 @@ int OOBase::detail::ProactorPoll::run(int& err, const Timeout& timeout)
 						err = errno;
 					else
 					{
-						count = ::poll(m_poll_fds.at(0),rl.rlim_cur,local_timeout.millisecs());
+						count = wait(rl.rlim_cur,local_timeout);
 						if (count == -1)
 							err = errno;
 					}
@@ -272,6 +385,13 @@ int OOBase::detail::ProactorPoll::run(int& err, const Timeout& timeout)
 					break;
 			}
 
+			if (stats)
+			{
+				stats_inc(stats->m_wakeups);
+				stats_record(stats->m_wait_usecs,stats_clock() - wait_start);
+				stats_record(stats->m_events_per_wakeup,count);
+			}
+
 			if (count == 0)
 			{
 				// Poll timed out
@@ -291,8 +411,13 @@ int OOBase::detail::ProactorPoll::run(int& err, const Timeout& timeout)
 		{
 			guard.release();
 
+			uint64_t callback_start = (stats ? stats_clock() : 0);
+
 			if (timer_event)
 			{
+				if (stats && active_timer.m_due)
+					stats_record(stats->m_timer_late_usecs,callback_start > active_timer.m_due ? callback_start - active_timer.m_due : 0);
+
 				err = process_timer(active_timer);
 				if (err)
 					return -1;
@@ -302,6 +427,9 @@ int OOBase::detail::ProactorPoll::run(int& err, const Timeout& timeout)
 				(*active_fd.m_callback)(active_fd.m_fd,active_fd.m_param,active_fd.m_events);
 			}
 
+			if (stats)
+				stats_record(stats->m_callback_usecs,stats_clock() - callback_start);
+
 			guard.acquire();
 
 			// Always check the control pipe if we have done something
@@ -309,6 +437,28 @@ int OOBase::detail::ProactorPoll::run(int& err, const Timeout& timeout)
 			if (err)
 				return -1;
 		}
+
+		// Run a batch of posted callbacks, each pass
+		PostItem* posts = pop_posts(more_posts);
+		if (posts)
+		{
+			guard.release();
+
+			uint64_t callback_start = (stats ? stats_clock() : 0);
+
+			run_posts(posts,stats);
+
+			if (stats)
+				stats_record(stats->m_callback_usecs,stats_clock() - callback_start);
+
+			guard.acquire();
+
+			end_posts(more_posts);
+
+			err = read_control();
+			if (err)
+				return -1;
+		}
 	}
 
     if (err)
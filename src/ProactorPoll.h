@@ -69,6 +69,8 @@ namespace OOBase
 			bool do_watch_fd(int fd, unsigned int events);
 
 			bool update_fds(FdEvent& active_fd, int poll_count, int& err);
+			int spin_poll(unsigned int& budget, unsigned int limit, const Timeout& timeout, ProactorStats* stats);
+			int wait(nfds_t count, const Timeout& timeout);
 		};
 	}
 }
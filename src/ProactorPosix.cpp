@@ -23,9 +23,17 @@
 
 #if defined(HAVE_UNISTD_H)
 
+#include "../include/OOBase/Atomic.h"
+
 #include "ProactorPosix.h"
 #include "BSDSocket.h"
 
+#include <time.h>
+
+#if defined(HAVE_SYS_EVENTFD_H)
+#include <sys/eventfd.h>
+#endif
+
 namespace
 {
 	enum ControlType
@@ -35,7 +43,8 @@ namespace
 		eCTWatch,
 		eCTUnbind,
 		eCTTimerAdd,
-		eCTTimerRemove
+		eCTTimerRemove,
+		eCTPost
 	};
 
 	struct ControlMessage
@@ -73,16 +82,46 @@ namespace
 	};
 }
 
+OOBase::detail::ProactorPosix::ThreadStats::ThreadStats() :
+		m_attached(false),
+		m_next(NULL)
+{
+	memset(&m_stats,0,sizeof(m_stats));
+}
+
 OOBase::detail::ProactorPosix::ProactorPosix() :
 		m_stopped(false),
 		m_read_fd(-1),
+		m_post_fd(-1),
+		m_stats_enabled(false),
+		m_stats_max_fds(0),
+		m_busy_poll_usecs(0),
+		m_busy_poll_sockets(false),
+		m_recv_budget_bytes(0),
+		m_recv_budget_ops(0),
 		m_timers(m_allocator),
-		m_write_fd(-1)
+		m_write_fd(-1),
+		m_post_head(&m_post_stub),
+		m_post_tail(&m_post_stub),
+		m_post_wake(0),
+		m_post_draining(false),
+		m_post_retry(false),
+		m_stats_threads(NULL),
+		m_stats_control_messages(0),
+		m_stats_max_timers(0)
 {
+	memset(&m_stats_retired,0,sizeof(m_stats_retired));
+	memset(&m_stats_baseline,0,sizeof(m_stats_baseline));
+	memset(&m_post_stub,0,sizeof(m_post_stub));
 }
 
 OOBase::detail::ProactorPosix::~ProactorPosix()
 {
+	// Anything still posted is dropped
+	while (PostItem* item = pop_post())
+		CrtAllocator::delete_free(item);
+
+	POSIX::close(m_post_fd);
 	POSIX::close(m_write_fd);
 	POSIX::close(m_read_fd);
 }
@@ -96,12 +135,7 @@ int OOBase::detail::ProactorPosix::init()
 	if (::pipe2(pipe_ends,O_CLOEXEC) != 0)
 		return errno;
 
-	m_read_fd = pipe_ends[0];
-	m_write_fd = pipe_ends[1];
-
 	int err = POSIX::set_non_blocking(pipe_ends[0],true);
-
-	return 0;
 #else
 	if (::pipe(pipe_ends) != 0)
 		return errno;
@@ -125,6 +159,16 @@ int OOBase::detail::ProactorPosix::init()
 		POSIX::close(pipe_ends[1]);
 	}
 
+#if defined(HAVE_SYS_EVENTFD_H)
+	// Wake-ups for post() go through an eventfd rather than the control pipe
+	if (!err)
+	{
+		m_post_fd = ::eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_post_fd == -1)
+			err = errno;
+	}
+#endif
+
 	return err;
 }
 
@@ -310,7 +354,20 @@ bool OOBase::detail::ProactorPosix::add_timer(void* param, timer_callback_t call
 	ti.m_param = param;
 	ti.m_callback = callback;
 	ti.m_timeout = timeout;
-	return m_timers.insert(ti);
+	ti.m_due = 0;
+
+	timeval tv;
+	bool stats = stats_enabled();
+	if (stats && timeout.get_timeval(tv))
+		ti.m_due = stats_clock() + static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+
+	if (!m_timers.insert(ti))
+		return false;
+
+	if (stats)
+		stats_high_water(m_stats_max_timers,m_timers.size());
+
+	return true;
 }
 
 bool OOBase::detail::ProactorPosix::remove_timer(void* param)
@@ -344,6 +401,9 @@ int OOBase::detail::ProactorPosix::read_control()
 		if (recv != sizeof(msg))
 			return EPIPE;
 
+		if (stats_enabled())
+			__atomic_fetch_add(&m_stats_control_messages,1,__ATOMIC_RELAXED);
+
 		int err = 0;
 		switch (msg.m_type)
 		{
@@ -371,6 +431,11 @@ int OOBase::detail::ProactorPosix::read_control()
 			err = remove_timer(msg.m_timer_remove_info.m_param);
 			break;
 
+		case eCTPost:
+			// Re-arm before the caller drains the queue, so later posts wake us again
+			Atomic<size_t>::Exchange(m_post_wake,0);
+			break;
+
 		default:
 			err = EINVAL;
 			break;
@@ -381,4 +446,369 @@ int OOBase::detail::ProactorPosix::read_control()
 	}
 }
 
+int OOBase::detail::ProactorPosix::post(void* param, post_callback_t callback)
+{
+	PostItem* item = NULL;
+	if (!CrtAllocator::allocate_new(item))
+		return ERROR_OUTOFMEMORY;
+
+	item->m_param = param;
+	item->m_callback = callback;
+	push_post(item);
+
+	// Only the first post since the loop last looked needs to wake it
+	if (Atomic<size_t>::Exchange(m_post_wake,1))
+		return 0;
+
+	int err = 0;
+	if (m_post_fd != -1)
+	{
+#if defined(HAVE_SYS_EVENTFD_H)
+		if (::eventfd_write(m_post_fd,1) != 0)
+			err = errno;
+#endif
+	}
+	else
+	{
+		ControlMessage msg;
+		memset(&msg,0,sizeof(msg));
+		msg.m_type = eCTPost;
+		msg.m_future = NULL;
+
+		ssize_t sent = POSIX::write(m_write_fd,&msg,sizeof(msg));
+		if (sent == -1)
+			err = errno;
+		else if (sent != sizeof(msg))
+			err = EIO;
+	}
+
+	// The item is already queued, so it cannot be handed back
+	if (err)
+		OOBase_CallCriticalFailure(err);
+
+	return 0;
+}
+
+int OOBase::detail::ProactorPosix::read_post_fd()
+{
+#if defined(HAVE_SYS_EVENTFD_H)
+	eventfd_t val = 0;
+	if (::eventfd_read(m_post_fd,&val) != 0 && errno != EAGAIN)
+		return errno;
+#endif
+
+	// Re-arm before the caller drains the queue, so later posts wake us again
+	Atomic<size_t>::Exchange(m_post_wake,0);
+	return 0;
+}
+
+OOBase::detail::ProactorPosix::PostItem* OOBase::detail::ProactorPosix::load_next(PostItem* item)
+{
+	// A compare that never succeeds is a fenced load
+	return Atomic<PostItem*>::CompareAndSwap(item->m_next,NULL,NULL);
+}
+
+void OOBase::detail::ProactorPosix::push_post(PostItem* item)
+{
+	item->m_next = NULL;
+
+	PostItem* prev = Atomic<PostItem*>::Exchange(m_post_head,item);
+	Atomic<PostItem*>::Exchange(prev->m_next,item);
+}
+
+OOBase::detail::ProactorPosix::PostItem* OOBase::detail::ProactorPosix::pop_post()
+{
+	PostItem* tail = m_post_tail;
+	PostItem* next = load_next(tail);
+	if (tail == &m_post_stub)
+	{
+		if (!next)
+			return NULL;
+
+		m_post_tail = next;
+		tail = next;
+		next = load_next(next);
+	}
+
+	if (!next)
+	{
+		// A producer has swapped the head but not linked it yet, it wakes us when it has
+		if (tail != Atomic<PostItem*>::CompareAndSwap(m_post_head,NULL,NULL))
+			return NULL;
+
+		// tail is the last item, queue the stub behind it so it can be taken
+		push_post(&m_post_stub);
+		next = load_next(tail);
+		if (!next)
+			return NULL;
+	}
+
+	m_post_tail = next;
+	return tail;
+}
+
+OOBase::detail::ProactorPosix::PostItem* OOBase::detail::ProactorPosix::pop_posts(bool& more)
+{
+	// Bounded, so a busy producer cannot starve timers and I/O
+	static const size_t batch = 64;
+
+	more = false;
+
+	// Only one thread runs posts at a time, so they stay in order with several threads in run()
+	if (m_post_draining)
+	{
+		m_post_retry = true;
+		return NULL;
+	}
+
+	PostItem* items = NULL;
+	PostItem* last = NULL;
+	size_t count = 0;
+	for (;count < batch;++count)
+	{
+		PostItem* item = pop_post();
+		if (!item)
+			break;
+
+		item->m_next = NULL;
+		if (last)
+			last->m_next = item;
+		else
+			items = item;
+		last = item;
+	}
+
+	more = (count == batch);
+	m_post_draining = (items != NULL);
+	return items;
+}
+
+void OOBase::detail::ProactorPosix::end_posts(bool& more)
+{
+	m_post_draining = false;
+
+	// Another thread was turned away while we ran, so go round again without blocking
+	if (m_post_retry)
+	{
+		m_post_retry = false;
+		more = true;
+	}
+}
+
+void OOBase::detail::ProactorPosix::run_posts(PostItem* items, ProactorStats* stats)
+{
+	while (items)
+	{
+		PostItem* item = items;
+		items = item->m_next;
+
+		void* param = item->m_param;
+		post_callback_t callback = item->m_callback;
+		CrtAllocator::delete_free(item);
+
+		if (stats)
+			stats_inc(stats->m_posts);
+
+		(*callback)(param);
+	}
+}
+
+uint64_t OOBase::detail::ProactorPosix::stats_clock()
+{
+	timespec ts = {0};
+	::clock_gettime(CLOCK_MONOTONIC,&ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void OOBase::detail::ProactorPosix::stats_record(ProactorStats::Histogram& histogram, uint64_t value)
+{
+	size_t bucket = 0;
+	for (uint64_t v = value; v && bucket < ProactorStats::HistogramBuckets - 1; v >>= 1)
+		++bucket;
+
+	stats_inc(histogram.m_count);
+	stats_inc(histogram.m_sum,value);
+	stats_inc(histogram.m_buckets[bucket]);
+}
+
+void OOBase::detail::ProactorPosix::stats_inc(uint64_t& counter, uint64_t value)
+{
+	// Only the owning thread writes, so a relaxed load and store is enough,
+	// and avoids a locked add on every event
+	__atomic_store_n(&counter,__atomic_load_n(&counter,__ATOMIC_RELAXED) + value,__ATOMIC_RELAXED);
+}
+
+uint64_t OOBase::detail::ProactorPosix::stats_load(const uint64_t& counter)
+{
+	return __atomic_load_n(&counter,__ATOMIC_RELAXED);
+}
+
+void OOBase::detail::ProactorPosix::stats_add(ProactorStats& total, const ProactorStats& stats)
+{
+	total.m_wakeups += stats_load(stats.m_wakeups);
+	total.m_busy_poll_hits += stats_load(stats.m_busy_poll_hits);
+	total.m_busy_poll_misses += stats_load(stats.m_busy_poll_misses);
+	total.m_posts += stats_load(stats.m_posts);
+
+	const ProactorStats::Histogram* src[] = { &stats.m_wait_usecs, &stats.m_events_per_wakeup, &stats.m_callback_usecs, &stats.m_timer_late_usecs };
+	ProactorStats::Histogram* dest[] = { &total.m_wait_usecs, &total.m_events_per_wakeup, &total.m_callback_usecs, &total.m_timer_late_usecs };
+	for (size_t h = 0; h < sizeof(src)/sizeof(src[0]); ++h)
+	{
+		dest[h]->m_count += stats_load(src[h]->m_count);
+		dest[h]->m_sum += stats_load(src[h]->m_sum);
+		for (size_t i = 0; i < ProactorStats::HistogramBuckets; ++i)
+			dest[h]->m_buckets[i] += stats_load(src[h]->m_buckets[i]);
+	}
+}
+
+void OOBase::detail::ProactorPosix::stats_attach(ThreadStats& thread_stats)
+{
+	Guard<SpinLock> guard(m_stats_lock);
+
+	thread_stats.m_next = m_stats_threads;
+	m_stats_threads = &thread_stats;
+	thread_stats.m_attached = true;
+}
+
+void OOBase::detail::ProactorPosix::stats_detach(ThreadStats& thread_stats)
+{
+	Guard<SpinLock> guard(m_stats_lock);
+
+	for (ThreadStats** pp = &m_stats_threads; *pp; pp = &(*pp)->m_next)
+	{
+		if (*pp == &thread_stats)
+		{
+			*pp = thread_stats.m_next;
+			break;
+		}
+	}
+
+	// Keep the totals of threads that have left run()
+	stats_add(m_stats_retired,thread_stats.m_stats);
+	thread_stats.m_attached = false;
+}
+
+bool OOBase::detail::ProactorPosix::stats_enabled() const
+{
+	return __atomic_load_n(&m_stats_enabled,__ATOMIC_RELAXED);
+}
+
+void OOBase::detail::ProactorPosix::stats_high_water(size_t& high_water, size_t value)
+{
+	if (!stats_enabled())
+		return;
+
+	Guard<SpinLock> guard(m_stats_lock);
+
+	if (value > high_water)
+		high_water = value;
+}
+
+int OOBase::detail::ProactorPosix::enable_stats(bool enable)
+{
+	__atomic_store_n(&m_stats_enabled,enable,__ATOMIC_RELAXED);
+	return 0;
+}
+
+int OOBase::detail::ProactorPosix::get_stats(ProactorStats& stats, bool reset)
+{
+	Guard<SpinLock> guard(m_stats_lock);
+
+	ProactorStats total = m_stats_retired;
+
+	// Per-thread counters are read without stopping their owners,
+	// so a snapshot taken while running is only approximate
+	for (ThreadStats* t = m_stats_threads; t; t = t->m_next)
+		stats_add(total,t->m_stats);
+
+	total.m_control_messages = stats_load(m_stats_control_messages);
+	total.m_max_fds = m_stats_max_fds;
+	total.m_max_timers = m_stats_max_timers;
+
+	// Report the difference from the last reset
+	stats = total;
+	stats.m_wakeups -= m_stats_baseline.m_wakeups;
+	stats.m_control_messages -= m_stats_baseline.m_control_messages;
+	stats.m_busy_poll_hits -= m_stats_baseline.m_busy_poll_hits;
+	stats.m_busy_poll_misses -= m_stats_baseline.m_busy_poll_misses;
+	stats.m_posts -= m_stats_baseline.m_posts;
+
+	const ProactorStats::Histogram* base[] = { &m_stats_baseline.m_wait_usecs, &m_stats_baseline.m_events_per_wakeup, &m_stats_baseline.m_callback_usecs, &m_stats_baseline.m_timer_late_usecs };
+	ProactorStats::Histogram* dest[] = { &stats.m_wait_usecs, &stats.m_events_per_wakeup, &stats.m_callback_usecs, &stats.m_timer_late_usecs };
+	for (size_t h = 0; h < sizeof(base)/sizeof(base[0]); ++h)
+	{
+		dest[h]->m_count -= base[h]->m_count;
+		dest[h]->m_sum -= base[h]->m_sum;
+		for (size_t i = 0; i < ProactorStats::HistogramBuckets; ++i)
+			dest[h]->m_buckets[i] -= base[h]->m_buckets[i];
+	}
+
+	if (reset)
+	{
+		m_stats_baseline = total;
+		m_stats_max_fds = 0;
+		m_stats_max_timers = 0;
+	}
+
+	return 0;
+}
+
+int OOBase::detail::ProactorPosix::set_busy_poll(unsigned int spin_usecs, bool socket_busy_poll)
+{
+#if !defined(SO_BUSY_POLL)
+	if (socket_busy_poll)
+		return ENOTSUP;
+#endif
+
+	Guard<SpinLock> guard(m_tuning_lock);
+
+	m_busy_poll_usecs = spin_usecs;
+	m_busy_poll_sockets = (spin_usecs && socket_busy_poll);
+	return 0;
+}
+
+unsigned int OOBase::detail::ProactorPosix::busy_poll_usecs()
+{
+	Guard<SpinLock> guard(m_tuning_lock);
+
+	return m_busy_poll_usecs;
+}
+
+int OOBase::detail::ProactorPosix::set_recv_budget(size_t bytes, size_t ops)
+{
+	Guard<SpinLock> guard(m_tuning_lock);
+
+	m_recv_budget_bytes = bytes;
+	m_recv_budget_ops = ops;
+	return 0;
+}
+
+void OOBase::detail::ProactorPosix::recv_budget(size_t& bytes, size_t& ops)
+{
+	Guard<SpinLock> guard(m_tuning_lock);
+
+	bytes = m_recv_budget_bytes;
+	ops = m_recv_budget_ops;
+}
+
+void OOBase::detail::ProactorPosix::busy_poll_socket(int fd)
+{
+#if defined(SO_BUSY_POLL)
+	Guard<SpinLock> guard(m_tuning_lock);
+
+	bool enabled = m_busy_poll_sockets;
+	int val = static_cast<int>(m_busy_poll_usecs);
+
+	guard.release();
+
+	if (enabled)
+	{
+		// Best effort, values above net.core.busy_read need CAP_NET_ADMIN
+		::setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL,&val,sizeof(val));
+	}
+#else
+	(void)fd;
+#endif
+}
+
 #endif // defined(HAVE_UNISTD_H)
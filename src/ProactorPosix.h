@@ -43,13 +43,19 @@ namespace OOBase
 		// Proactor public members
 		public:
 			Acceptor* accept(void* param, accept_pipe_callback_t callback, const char* path, int& err, SECURITY_ATTRIBUTES* psa);
-			Acceptor* accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err);
+			Acceptor* accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err, const SocketOptions* options);
 
 			AsyncSocket* attach(socket_t sock, int& err);
 
-			AsyncSocket* connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout);
+			AsyncSocket* connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout, const SocketOptions* options);
 			AsyncSocket* connect(const char* path, int& err, const Timeout& timeout);
 
+			AsyncDatagramSocket* open_datagram(const sockaddr* addr, socklen_t addr_len, int& err);
+			AsyncDatagramSocket* attach_datagram(socket_t sock, int& err);
+
+			Acceptor* accept_shared(void* param, accept_pipe_callback_t callback, const char* path, int& err, SECURITY_ATTRIBUTES* psa);
+			AsyncSocket* connect_shared(const char* path, int& err, const Timeout& timeout, size_t ring_size);
+
 		// 'Internal' public members
 		public:
 			typedef void (*fd_callback_t)(int fd, void* param, unsigned int events);
@@ -59,14 +65,32 @@ namespace OOBase
 
 			int watch_fd(int fd, unsigned int events);
 
-			typedef Timeout (*timer_callback_t)(void* param);
-
 			int start_timer(void* param, timer_callback_t callback, const Timeout& timeout);
 			int stop_timer(void* param);
 
+			// Monotonic time in microseconds
+			static uint64_t stats_clock();
+
 			void stop();
 			int restart();
 
+			int enable_stats(bool enable);
+			int get_stats(ProactorStats& stats, bool reset);
+
+			int set_busy_poll(unsigned int spin_usecs, bool socket_busy_poll);
+
+			// Applies SO_BUSY_POLL to a new socket, if set_busy_poll() asked for it
+			void busy_poll_socket(int fd);
+
+			unsigned int busy_poll_usecs();
+
+			int set_recv_budget(size_t bytes, size_t ops);
+			void recv_budget(size_t& bytes, size_t& ops);
+
+			int post(void* param, post_callback_t callback);
+
+			FdWatcher* watch(void* param, watch_callback_t callback, int fd, unsigned int events, FdWatcher::Mode mode, int& err);
+
 			AllocatorInstance& get_internal_allocator()
 			{
 				return m_allocator;
@@ -78,6 +102,7 @@ namespace OOBase
 				void*            m_param;
 				timer_callback_t m_callback;
 				Timeout          m_timeout;
+				uint64_t         m_due;       // stats_clock() due time, 0 unless gathering statistics
 
 				bool operator > (const TimerItem& rhs) const
 				{
@@ -90,6 +115,46 @@ namespace OOBase
 				}
 			};
 
+			// Per-run() thread statistics, only written by the owning thread with stats_inc(),
+			// and read by get_stats() with relaxed atomic loads
+			struct ThreadStats
+			{
+				ThreadStats();
+
+				ProactorStats m_stats;
+				bool          m_attached;
+				ThreadStats*  m_next;
+			};
+
+			// Attaches a ThreadStats for the lifetime of a run() call
+			class StatsScope : public NonCopyable
+			{
+			public:
+				StatsScope(ProactorPosix* pProactor) : m_pProactor(pProactor)
+				{}
+
+				~StatsScope()
+				{
+					if (m_thread_stats.m_attached)
+						m_pProactor->stats_detach(m_thread_stats);
+				}
+
+				ProactorStats* get()
+				{
+					if (!m_pProactor->stats_enabled())
+						return NULL;
+
+					if (!m_thread_stats.m_attached)
+						m_pProactor->stats_attach(m_thread_stats);
+
+					return &m_thread_stats.m_stats;
+				}
+
+			private:
+				ProactorPosix* m_pProactor;
+				ThreadStats    m_thread_stats;
+			};
+
 			ProactorPosix();
 			virtual ~ProactorPosix();
 
@@ -104,17 +169,87 @@ namespace OOBase
 			virtual bool do_watch_fd(int fd, unsigned int events) = 0;
 			virtual bool do_unbind_fd(int fd) = 0;
 
+			// A node of the post() queue
+			struct PostItem
+			{
+				PostItem*       m_next;
+				void*           m_param;
+				post_callback_t m_callback;
+			};
+
+			// Takes up to a batch of posted items in order, with m_lock held.
+			// more is set when the batch is full, so the caller should not block.
+			// Returns NULL while another thread is running a batch.
+			PostItem* pop_posts(bool& more);
+
+			// Called with m_lock held after run_posts(), so the next batch can be taken
+			void end_posts(bool& more);
+
+			// Runs and frees the items from pop_posts(), without m_lock held
+			static void run_posts(PostItem* items, ProactorStats* stats);
+
+			int read_post_fd();
+
+			static void stats_record(ProactorStats::Histogram& histogram, uint64_t value);
+			static void stats_inc(uint64_t& counter, uint64_t value = 1);
+			static uint64_t stats_load(const uint64_t& counter);
+
+			void stats_attach(ThreadStats& thread_stats);
+			void stats_detach(ThreadStats& thread_stats);
+
+			// Lock-free, may be called with or without m_lock held
+			bool stats_enabled() const;
+
+			// Takes m_stats_lock only while stats are enabled
+			void stats_high_water(size_t& high_water, size_t value);
+
 			Mutex                 m_lock;
 			LockedAllocator<4096> m_allocator;
 			bool                  m_stopped;
 			int                   m_read_fd;
+			int                   m_post_fd;   // eventfd signalled by post(), -1 if it uses the control pipe
+
+			// Statistics, guarded by m_stats_lock as run() holds m_lock while it waits.
+			// m_stats_enabled is a relaxed atomic flag, so the hot paths never take the lock
+			bool                  m_stats_enabled;
+			size_t                m_stats_max_fds;
+
+			// Read by run() at each wait, so changes apply from the next one.
+			// Guarded by m_tuning_lock, as run() holds m_lock while it waits
+			SpinLock              m_tuning_lock;
+			unsigned int          m_busy_poll_usecs;
+			bool                  m_busy_poll_sockets;
+
+			// Read by each socket at each wakeup, 0 is unlimited. Also guarded by m_tuning_lock
+			size_t                m_recv_budget_bytes;
+			size_t                m_recv_budget_ops;
 
 		private:
 			Set<TimerItem,Greater<TimerItem>,AllocatorInstance> m_timers;
 			int                                                 m_write_fd;
 
+			// Intrusive MPSC queue: producers swap m_post_head, m_post_tail is only used with m_lock held
+			PostItem*                                           m_post_head;
+			PostItem*                                           m_post_tail;
+			PostItem                                            m_post_stub;
+			size_t                                              m_post_wake;  // Non-zero while a wake-up is outstanding
+			bool                                                m_post_draining; // Set with m_lock held while a batch runs
+			bool                                                m_post_retry;    // A thread found m_post_draining set
+
+			SpinLock                                            m_stats_lock;
+			ThreadStats*                                        m_stats_threads;
+			ProactorStats                                       m_stats_retired;
+			ProactorStats                                       m_stats_baseline;
+			uint64_t                                            m_stats_control_messages; // Relaxed atomic counter
+			size_t                                              m_stats_max_timers;
+
+			static void stats_add(ProactorStats& total, const ProactorStats& stats);
+
 			bool add_timer(void* param, timer_callback_t callback, const Timeout& timeout);
 			bool remove_timer(void* param);
+			static PostItem* load_next(PostItem* item);
+			void push_post(PostItem* item);
+			PostItem* pop_post();
 			int watch_fd_i(int fd, unsigned int events, Future<int>* future);
 		};
 	}
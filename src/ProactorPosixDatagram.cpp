@@ -0,0 +1,575 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+// recvmmsg() and sendmmsg() are GNU extensions
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "../include/OOBase/Posix.h"
+#include "../include/OOBase/Queue.h"
+#include "../include/OOBase/StackAllocator.h"
+
+#include "ProactorPosix.h"
+#include "BSDSocket.h"
+
+#if defined(HAVE_UNISTD_H)
+
+#include <string.h>
+
+namespace
+{
+	// The most datagrams moved by one system call
+	const size_t DatagramBatch = 32;
+
+	class PosixDatagramSocket : public OOBase::AsyncDatagramSocket
+	{
+	public:
+		PosixDatagramSocket(OOBase::detail::ProactorPosix* pProactor, int fd);
+
+		int init();
+
+		int recv_from(void* param, recv_from_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& buffer);
+		int send_to(void* param, send_to_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& buffer, const sockaddr* addr, socklen_t addr_len);
+		OOBase::socket_t get_handle() const;
+		int enable_stats(bool enable);
+		int get_stats(OOBase::AsyncSocketStats& stats);
+
+	private:
+		virtual ~PosixDatagramSocket();
+
+		struct RecvItem
+		{
+			void*                m_param;
+			recv_from_callback_t m_callback;
+			OOBase::Buffer*      m_buffer;
+		};
+
+		// A receive taken off the queue for the next system call
+		struct RecvSlot
+		{
+			RecvItem         m_item;
+			sockaddr_storage m_addr;
+			socklen_t        m_addr_len;
+			int              m_err;
+		};
+
+		struct SendItem
+		{
+			void*              m_param;
+			send_to_callback_t m_callback;
+			OOBase::Buffer*    m_buffer;
+			sockaddr_storage   m_addr;
+			socklen_t          m_addr_len;
+		};
+
+		struct SendNotify
+		{
+			int      m_err;
+			SendItem m_item;
+		};
+
+		OOBase::detail::ProactorPosix* m_pProactor;
+		int                            m_fd;
+		OOBase::Mutex                  m_lock;
+		OOBase::Queue<RecvItem>        m_recv_queue;
+		OOBase::Queue<SendItem>        m_send_queue;
+		RecvSlot                       m_recv_batch[DatagramBatch];
+		size_t                         m_recv_batched;
+		SendItem                       m_send_batch[DatagramBatch];
+		size_t                         m_send_batched;
+		bool                           m_stats_enabled;
+		OOBase::AsyncSocketStats       m_stats;
+
+		static void fd_callback(int fd, void* param, unsigned int events);
+		void process_recv(OOBase::Queue<RecvSlot,OOBase::AllocatorInstance>& notify_queue);
+		int recv_batch(size_t& count);
+		void process_send(OOBase::Queue<SendNotify,OOBase::AllocatorInstance>& notify_queue);
+		int send_batch(size_t& count);
+
+		void stats_io(ssize_t r, OOBase::uint64_t& total, OOBase::uint64_t bytes);
+
+		virtual void destroy()
+		{
+			OOBase::CrtAllocator::delete_free(this);
+		}
+	};
+}
+
+PosixDatagramSocket::PosixDatagramSocket(OOBase::detail::ProactorPosix* pProactor, int fd) :
+		m_pProactor(pProactor),
+		m_fd(fd),
+		m_recv_batched(0),
+		m_send_batched(0),
+		m_stats_enabled(false)
+{
+	memset(&m_stats,0,sizeof(m_stats));
+}
+
+PosixDatagramSocket::~PosixDatagramSocket()
+{
+	m_pProactor->unbind_fd(m_fd);
+
+	OOBase::Net::close_socket(m_fd);
+
+	// Free all items
+	for (size_t i = 0; i < m_recv_batched; ++i)
+		m_recv_batch[i].m_item.m_buffer->release();
+
+	RecvItem recv_item;
+	while (m_recv_queue.pop(&recv_item))
+		recv_item.m_buffer->release();
+
+	for (size_t i = 0; i < m_send_batched; ++i)
+		m_send_batch[i].m_buffer->release();
+
+	SendItem send_item;
+	while (m_send_queue.pop(&send_item))
+		send_item.m_buffer->release();
+}
+
+int PosixDatagramSocket::init()
+{
+	m_pProactor->busy_poll_socket(m_fd);
+
+	return m_pProactor->bind_fd(m_fd,this,&fd_callback);
+}
+
+int PosixDatagramSocket::recv_from(void* param, recv_from_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& buffer)
+{
+	if (!buffer || !buffer->space() || !callback)
+		return EINVAL;
+
+	RecvItem item = { param, callback, buffer.addref() };
+
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	bool watch = (m_recv_batched == 0 && m_recv_queue.empty());
+	int err = m_recv_queue.push(item) ? 0 : ERROR_OUTOFMEMORY;
+	if (!err && ++m_stats.m_recv_queue > m_stats.m_recv_queue_max)
+		m_stats.m_recv_queue_max = m_stats.m_recv_queue;
+
+	guard.release();
+
+	if (err)
+	{
+		item.m_buffer->release();
+		return err;
+	}
+
+	return (watch ? m_pProactor->watch_fd(m_fd,OOBase::detail::eTXRecv) : 0);
+}
+
+int PosixDatagramSocket::send_to(void* param, send_to_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& buffer, const sockaddr* addr, socklen_t addr_len)
+{
+	if (!buffer || !addr || addr_len > static_cast<socklen_t>(sizeof(sockaddr_storage)))
+		return EINVAL;
+
+	SendItem item = { param, callback, buffer.addref() };
+	memcpy(&item.m_addr,addr,addr_len);
+	item.m_addr_len = addr_len;
+
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	bool watch = (m_send_batched == 0 && m_send_queue.empty());
+	int err = m_send_queue.push(item) ? 0 : ERROR_OUTOFMEMORY;
+	if (!err && ++m_stats.m_send_queue > m_stats.m_send_queue_max)
+		m_stats.m_send_queue_max = m_stats.m_send_queue;
+
+	guard.release();
+
+	if (err)
+	{
+		item.m_buffer->release();
+		return err;
+	}
+
+	return (watch ? m_pProactor->watch_fd(m_fd,OOBase::detail::eTXSend) : 0);
+}
+
+OOBase::socket_t PosixDatagramSocket::get_handle() const
+{
+	return m_fd;
+}
+
+int PosixDatagramSocket::enable_stats(bool enable)
+{
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	m_stats_enabled = enable;
+	return 0;
+}
+
+int PosixDatagramSocket::get_stats(OOBase::AsyncSocketStats& stats)
+{
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	stats = m_stats;
+	return 0;
+}
+
+void PosixDatagramSocket::stats_io(ssize_t r, OOBase::uint64_t& total, OOBase::uint64_t bytes)
+{
+	if (m_stats_enabled)
+	{
+		++m_stats.m_syscalls;
+		if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			++m_stats.m_eagain;
+		else if (r > 0)
+			total += bytes;
+	}
+}
+
+void PosixDatagramSocket::fd_callback(int fd, void* param, unsigned int events)
+{
+	PosixDatagramSocket* pThis = static_cast<PosixDatagramSocket*>(param);
+	if (pThis->m_fd != fd)
+		OOBase_CallCriticalFailure("Wrong fd passed to callback");
+
+	OOBase::StackAllocator<1024> allocator;
+	OOBase::Queue<RecvSlot,OOBase::AllocatorInstance> recv_notify_queue(allocator);
+	OOBase::Queue<SendNotify,OOBase::AllocatorInstance> send_notify_queue(allocator);
+
+	OOBase::Guard<OOBase::Mutex> guard(pThis->m_lock);
+
+	if (events & OOBase::detail::eTXRecv)
+		pThis->process_recv(recv_notify_queue);
+
+	if (events & OOBase::detail::eTXSend)
+		pThis->process_send(send_notify_queue);
+
+	guard.release();
+
+	RecvSlot recv_notify;
+	while (recv_notify_queue.pop(&recv_notify))
+	{
+		// Hand our reference to the callback
+		OOBase::RefPtr<OOBase::Buffer> buffer(recv_notify.m_item.m_buffer);
+		(*recv_notify.m_item.m_callback)(recv_notify.m_item.m_param,buffer,reinterpret_cast<const sockaddr*>(&recv_notify.m_addr),recv_notify.m_addr_len,recv_notify.m_err);
+	}
+
+	SendNotify send_notify;
+	while (send_notify_queue.pop(&send_notify))
+	{
+		OOBase::RefPtr<OOBase::Buffer> buffer(send_notify.m_item.m_buffer);
+		if (send_notify.m_item.m_callback)
+			(*send_notify.m_item.m_callback)(send_notify.m_item.m_param,buffer,send_notify.m_err);
+	}
+}
+
+int PosixDatagramSocket::recv_batch(size_t& count)
+{
+	// Fill as many of the batched receives as there are datagrams waiting
+	count = 0;
+
+#if defined(HAVE_RECVMMSG)
+	struct mmsghdr msgs[DatagramBatch];
+	struct iovec iov[DatagramBatch];
+	memset(msgs,0,m_recv_batched * sizeof(struct mmsghdr));
+
+	for (size_t i = 0; i < m_recv_batched; ++i)
+	{
+		OOBase::Buffer* buffer = m_recv_batch[i].m_item.m_buffer;
+		iov[i].iov_base = buffer->wr_ptr();
+		iov[i].iov_len = buffer->space();
+
+		msgs[i].msg_hdr.msg_name = &m_recv_batch[i].m_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int r = 0;
+	do
+	{
+		r = ::recvmmsg(m_fd,msgs,static_cast<unsigned int>(m_recv_batched),MSG_DONTWAIT,NULL);
+	}
+	while (r == -1 && errno == EINTR);
+
+	OOBase::uint64_t bytes = 0;
+	for (int i = 0; i < r; ++i)
+		bytes += msgs[i].msg_len;
+
+	stats_io(r,m_stats.m_bytes_in,bytes);
+
+	if (r == -1)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : errno;
+
+	for (count = 0; count < static_cast<size_t>(r); ++count)
+	{
+		RecvSlot& slot = m_recv_batch[count];
+		slot.m_addr_len = msgs[count].msg_hdr.msg_namelen;
+		slot.m_err = (msgs[count].msg_hdr.msg_flags & MSG_TRUNC) ? EMSGSIZE : 0;
+		slot.m_item.m_buffer->wr_ptr(msgs[count].msg_len);
+	}
+#else
+	for (; count < m_recv_batched; ++count)
+	{
+		RecvSlot& slot = m_recv_batch[count];
+
+		struct iovec iov;
+		iov.iov_base = slot.m_item.m_buffer->wr_ptr();
+		iov.iov_len = slot.m_item.m_buffer->space();
+
+		struct msghdr msg = {0};
+		msg.msg_name = &slot.m_addr;
+		msg.msg_namelen = sizeof(sockaddr_storage);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		ssize_t r = 0;
+		do
+		{
+			r = ::recvmsg(m_fd,&msg,0);
+		}
+		while (r == -1 && errno == EINTR);
+
+		stats_io(r,m_stats.m_bytes_in,r);
+
+		if (r == -1)
+			return (count || errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : errno;
+
+		slot.m_addr_len = msg.msg_namelen;
+		slot.m_err = (msg.msg_flags & MSG_TRUNC) ? EMSGSIZE : 0;
+		slot.m_item.m_buffer->wr_ptr(r);
+	}
+#endif
+	return 0;
+}
+
+void PosixDatagramSocket::process_recv(OOBase::Queue<RecvSlot,OOBase::AllocatorInstance>& notify_queue)
+{
+	for (;;)
+	{
+		// Top up the batch from the queue
+		while (m_recv_batched < DatagramBatch && !m_recv_queue.empty())
+		{
+			m_recv_queue.pop(&m_recv_batch[m_recv_batched].m_item);
+			++m_recv_batched;
+		}
+
+		if (!m_recv_batched)
+			break;
+
+		size_t count = 0;
+		int err = recv_batch(count);
+		if (!count)
+		{
+			if (!err)
+			{
+				// Nothing waiting, watch for eTXRecv again
+				err = m_pProactor->watch_fd(m_fd,OOBase::detail::eTXRecv);
+				if (!err)
+					break;
+			}
+
+			// Fail the first receive alone, and try the rest again
+			m_recv_batch[0].m_addr_len = 0;
+			m_recv_batch[0].m_err = err;
+			count = 1;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			--m_stats.m_recv_queue;
+
+			if (!notify_queue.push(m_recv_batch[i]))
+			{
+				m_recv_batch[i].m_item.m_buffer->release();
+				OOBase_CallCriticalFailure(ERROR_OUTOFMEMORY);
+			}
+		}
+
+		m_recv_batched -= count;
+		memmove(m_recv_batch,m_recv_batch + count,m_recv_batched * sizeof(RecvSlot));
+	}
+}
+
+int PosixDatagramSocket::send_batch(size_t& count)
+{
+	// Send as many of the batched datagrams as the socket will take
+	count = 0;
+
+#if defined(HAVE_SENDMMSG)
+	struct mmsghdr msgs[DatagramBatch];
+	struct iovec iov[DatagramBatch];
+	memset(msgs,0,m_send_batched * sizeof(struct mmsghdr));
+
+	for (size_t i = 0; i < m_send_batched; ++i)
+	{
+		OOBase::Buffer* buffer = m_send_batch[i].m_buffer;
+		iov[i].iov_base = const_cast<OOBase::uint8_t*>(buffer->rd_ptr());
+		iov[i].iov_len = buffer->length();
+
+		msgs[i].msg_hdr.msg_name = &m_send_batch[i].m_addr;
+		msgs[i].msg_hdr.msg_namelen = m_send_batch[i].m_addr_len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int r = 0;
+	do
+	{
+		r = ::sendmmsg(m_fd,msgs,static_cast<unsigned int>(m_send_batched),MSG_DONTWAIT);
+	}
+	while (r == -1 && errno == EINTR);
+
+	OOBase::uint64_t bytes = 0;
+	for (int i = 0; i < r; ++i)
+	{
+		bytes += msgs[i].msg_len;
+		m_send_batch[i].m_buffer->rd_ptr(msgs[i].msg_len);
+	}
+
+	stats_io(r,m_stats.m_bytes_out,bytes);
+
+	if (r == -1)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : errno;
+
+	count = static_cast<size_t>(r);
+	return 0;
+#else
+	for (; count < m_send_batched; ++count)
+	{
+		SendItem& item = m_send_batch[count];
+
+		ssize_t r = 0;
+		do
+		{
+			r = ::sendto(m_fd,item.m_buffer->rd_ptr(),item.m_buffer->length(),0,reinterpret_cast<const sockaddr*>(&item.m_addr),item.m_addr_len);
+		}
+		while (r == -1 && errno == EINTR);
+
+		stats_io(r,m_stats.m_bytes_out,r);
+
+		if (r == -1)
+			return (count || errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : errno;
+
+		item.m_buffer->rd_ptr(r);
+	}
+	return 0;
+#endif
+}
+
+void PosixDatagramSocket::process_send(OOBase::Queue<SendNotify,OOBase::AllocatorInstance>& notify_queue)
+{
+	for (;;)
+	{
+		// Top up the batch from the queue
+		while (m_send_batched < DatagramBatch && !m_send_queue.empty())
+		{
+			m_send_queue.pop(&m_send_batch[m_send_batched]);
+			++m_send_batched;
+		}
+
+		if (!m_send_batched)
+			break;
+
+		size_t count = 0;
+		int err = send_batch(count);
+		if (!count)
+		{
+			if (!err)
+			{
+				// Socket buffer full, watch for eTXSend again
+				err = m_pProactor->watch_fd(m_fd,OOBase::detail::eTXSend);
+				if (!err)
+					break;
+			}
+
+			// Fail the first send alone, and try the rest again
+			count = 1;
+		}
+		else
+			err = 0;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			SendNotify notify;
+			notify.m_err = err;
+			notify.m_item = m_send_batch[i];
+			--m_stats.m_send_queue;
+
+			if (!notify_queue.push(notify))
+			{
+				notify.m_item.m_buffer->release();
+				OOBase_CallCriticalFailure(ERROR_OUTOFMEMORY);
+			}
+		}
+
+		m_send_batched -= count;
+		memmove(m_send_batch,m_send_batch + count,m_send_batched * sizeof(SendItem));
+	}
+}
+
+OOBase::AsyncDatagramSocket* OOBase::detail::ProactorPosix::open_datagram(const sockaddr* addr, socklen_t addr_len, int& err)
+{
+	if (!addr)
+	{
+		err = EINVAL;
+		return NULL;
+	}
+
+	int fd = Net::open_socket(addr->sa_family,SOCK_DGRAM,0,err);
+	if (err)
+		return NULL;
+
+	if ((err = Net::bind(fd,addr,addr_len)) != 0)
+	{
+		Net::close_socket(fd);
+		return NULL;
+	}
+
+	// attach_datagram() closes fd on failure
+	return attach_datagram(fd,err);
+}
+
+OOBase::AsyncDatagramSocket* OOBase::detail::ProactorPosix::attach_datagram(socket_t sock, int& err)
+{
+	// Set non-blocking...
+	err = POSIX::set_non_blocking(sock,true);
+	if (err)
+	{
+		Net::close_socket(sock);
+		return NULL;
+	}
+
+	PosixDatagramSocket* pSocket = NULL;
+	if (!OOBase::CrtAllocator::allocate_new(pSocket,this,sock))
+	{
+		Net::close_socket(sock);
+		err = ENOMEM;
+	}
+	else
+	{
+		err = pSocket->init();
+		if (err != 0)
+		{
+			pSocket->release();
+			pSocket = NULL;
+		}
+	}
+
+	return pSocket;
+}
+
+#endif // defined(HAVE_UNISTD_H)
@@ -0,0 +1,1148 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+// memfd_create() is a GNU extension
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "../include/OOBase/Posix.h"
+#include "../include/OOBase/Queue.h"
+#include "../include/OOBase/StackAllocator.h"
+
+#include "ProactorPosix.h"
+#include "BSDSocket.h"
+
+#if defined(HAVE_UNISTD_H)
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_EVENTFD_H) && defined(HAVE_SYS_MMAN_H)
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+
+namespace
+{
+	const OOBase::uint32_t ShmMagic = 0x4f4f5348; // 'OOSH'
+	const size_t DefaultRingSize = 256 * 1024;
+	const size_t MinRingSize = 4096;
+	const size_t MaxRingSize = size_t(1) << 30;
+
+	// One direction of the transport.  The indices increase freely and wrap at 2^32,
+	// and each field written by one side sits on its own cache line
+	struct ShmRing
+	{
+		OOBase::uint32_t m_head;             // Written by the producer
+		char             m_pad1[60];
+		OOBase::uint32_t m_tail;             // Written by the consumer
+		char             m_pad2[60];
+		OOBase::uint32_t m_consumer_waiting; // Set by the consumer before it sleeps on an empty ring
+		OOBase::uint32_t m_producer_waiting; // Set by the producer before it sleeps on a full ring
+		char             m_pad3[56];
+	};
+
+	// The start of the shared segment, followed by the data of m_rings[0] then m_rings[1]
+	struct ShmHeader
+	{
+		OOBase::uint32_t m_magic;
+		OOBase::uint32_t m_ring_size;
+		char             m_pad[56];
+		ShmRing          m_rings[2];         // [0] is client to server, [1] is server to client
+	};
+
+	// Sent by the client along with SCM_RIGHTS for the memfd, the client's eventfd and the server's eventfd
+	struct ShmHello
+	{
+		OOBase::uint32_t m_magic;
+		OOBase::uint32_t m_ring_size;
+	};
+
+	// The server replies with a single uint32_t error code
+	typedef OOBase::uint32_t ShmAck;
+
+	/* The peer can write anything to the shared header, so our own index is kept privately,
+	 * and the peer's is read once and checked before it is used to size a copy. */
+	class ShmRingEnd
+	{
+	public:
+		ShmRingEnd() : m_ring(NULL), m_data(NULL), m_mask(0), m_pos(0)
+		{}
+
+		void init(ShmRing* ring, OOBase::uint8_t* data, size_t size)
+		{
+			// Both indices start at 0, as ftruncate() zero fills the segment
+			m_ring = ring;
+			m_data = data;
+			m_mask = static_cast<OOBase::uint32_t>(size - 1);
+			m_pos = 0;
+		}
+
+		// Consumer side, returns false if the peer has corrupted the ring
+		bool readable(size_t& avail) const
+		{
+			OOBase::uint32_t used = __atomic_load_n(&m_ring->m_head,__ATOMIC_SEQ_CST) - m_pos;
+			if (used > m_mask + 1)
+				return false;
+
+			avail = used;
+			return true;
+		}
+
+		// Producer side, returns false if the peer has corrupted the ring
+		bool writable(size_t& avail) const
+		{
+			OOBase::uint32_t used = m_pos - __atomic_load_n(&m_ring->m_tail,__ATOMIC_SEQ_CST);
+			if (used > m_mask + 1)
+				return false;
+
+			avail = (m_mask + 1) - used;
+			return true;
+		}
+
+		// Consumer side, len is updated with the number of bytes copied
+		bool read(OOBase::uint8_t* dest, size_t& len)
+		{
+			size_t avail = 0;
+			if (!readable(avail))
+				return false;
+
+			if (len > avail)
+				len = avail;
+
+			if (len)
+			{
+				copy_out(dest,m_pos & m_mask,len);
+				m_pos += static_cast<OOBase::uint32_t>(len);
+				__atomic_store_n(&m_ring->m_tail,m_pos,__ATOMIC_SEQ_CST);
+			}
+			return true;
+		}
+
+		// Producer side, len is updated with the number of bytes copied
+		bool write(const OOBase::uint8_t* src, size_t& len)
+		{
+			size_t avail = 0;
+			if (!writable(avail))
+				return false;
+
+			if (len > avail)
+				len = avail;
+
+			if (len)
+			{
+				copy_in(src,m_pos & m_mask,len);
+				m_pos += static_cast<OOBase::uint32_t>(len);
+				__atomic_store_n(&m_ring->m_head,m_pos,__ATOMIC_SEQ_CST);
+			}
+			return true;
+		}
+
+		/* The sleep/wake handshake: a side sets its waiting flag, then re-checks the ring.
+		 * The other side updates the ring, then clears the flag and signals if it was set.
+		 * Both use sequentially consistent operations, so no wakeup is lost.
+		 * A corrupt ring never sleeps, so the next read() or write() reports it. */
+		bool wait_readable()
+		{
+			__atomic_store_n(&m_ring->m_consumer_waiting,1,__ATOMIC_SEQ_CST);
+			size_t avail = 0;
+			if (readable(avail) && !avail)
+				return true;
+
+			__atomic_store_n(&m_ring->m_consumer_waiting,0,__ATOMIC_SEQ_CST);
+			return false;
+		}
+
+		bool wait_writable()
+		{
+			__atomic_store_n(&m_ring->m_producer_waiting,1,__ATOMIC_SEQ_CST);
+			size_t avail = 0;
+			if (writable(avail) && !avail)
+				return true;
+
+			__atomic_store_n(&m_ring->m_producer_waiting,0,__ATOMIC_SEQ_CST);
+			return false;
+		}
+
+		bool wake_consumer()
+		{
+			return __atomic_exchange_n(&m_ring->m_consumer_waiting,0,__ATOMIC_SEQ_CST) != 0;
+		}
+
+		bool wake_producer()
+		{
+			return __atomic_exchange_n(&m_ring->m_producer_waiting,0,__ATOMIC_SEQ_CST) != 0;
+		}
+
+	private:
+		ShmRing*         m_ring;
+		OOBase::uint8_t* m_data;
+		OOBase::uint32_t m_mask;
+		OOBase::uint32_t m_pos;   // Our copy of m_tail as consumer, or m_head as producer
+
+		void copy_out(OOBase::uint8_t* dest, size_t pos, size_t len)
+		{
+			size_t first = (m_mask + 1) - pos;
+			if (first > len)
+				first = len;
+
+			memcpy(dest,m_data + pos,first);
+			if (len > first)
+				memcpy(dest + first,m_data,len - first);
+		}
+
+		void copy_in(const OOBase::uint8_t* src, size_t pos, size_t len)
+		{
+			size_t first = (m_mask + 1) - pos;
+			if (first > len)
+				first = len;
+
+			memcpy(m_data + pos,src,first);
+			if (len > first)
+				memcpy(m_data,src + first,len - first);
+		}
+	};
+
+	class ShmAsyncSocket : public OOBase::AsyncSocket
+	{
+	public:
+		ShmAsyncSocket(OOBase::detail::ProactorPosix* pProactor, OOBase::AsyncSocket* pControl, void* map, size_t map_len, bool bServer, int my_bell, int peer_bell);
+
+		int init();
+
+		int recv(void* param, recv_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& buffer, size_t bytes);
+		int recv_msg(void* param, recv_msg_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& data_buffer, const OOBase::RefPtr<OOBase::Buffer>& ctl_buffer, size_t data_bytes);
+		int send(void* param, send_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& buffer);
+		int send_v(void* param, send_v_callback_t callback, OOBase::Buffer* buffers[], size_t count);
+		int send_msg(void* param, send_msg_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& data_buffer, const OOBase::RefPtr<OOBase::Buffer>& ctl_buffer);
+		int shutdown(bool bSend, bool bRecv);
+		OOBase::socket_t get_handle() const;
+		int enable_stats(bool enable);
+		int get_stats(OOBase::AsyncSocketStats& stats);
+		int set_options(const OOBase::SocketOptions& options);
+		int set_watermarks(size_t high, size_t low, void* param, watermark_callback_t callback);
+
+	protected:
+		OOBase::AllocatorInstance& get_internal_allocator() const
+		{
+			return m_pProactor->get_internal_allocator();
+		}
+
+	private:
+		virtual ~ShmAsyncSocket();
+
+		struct RecvItem
+		{
+			void*           m_param;
+			recv_callback_t m_callback;
+			OOBase::Buffer* m_buffer;
+			size_t          m_bytes;
+		};
+
+		struct RecvNotify
+		{
+			int      m_err;
+			RecvItem m_item;
+		};
+
+		struct SendItem
+		{
+			void*              m_param;
+			size_t             m_count;
+			OOBase::Buffer*    m_buffer;
+			OOBase::Buffer**   m_buffers;
+			send_callback_t    m_callback;
+			send_v_callback_t  m_v_callback;
+		};
+
+		struct SendNotify
+		{
+			int      m_err;
+			SendItem m_item;
+		};
+
+		OOBase::detail::ProactorPosix*      m_pProactor;
+		OOBase::RefPtr<OOBase::AsyncSocket> m_ptrControl;
+		OOBase::RefPtr<OOBase::Buffer>      m_control_buffer;
+		void*                               m_map;
+		size_t                              m_map_len;
+		ShmRingEnd                          m_tx;
+		ShmRingEnd                          m_rx;
+		int                                 m_my_bell;
+		int                                 m_peer_bell;
+		OOBase::Mutex                       m_lock;
+		OOBase::Queue<RecvItem>             m_recv_queue;
+		OOBase::Queue<SendItem>             m_send_queue;
+		bool                                m_closed;
+		bool                                m_stats_enabled;
+		OOBase::AsyncSocketStats            m_stats;
+
+		static void fd_callback(int fd, void* param, unsigned int events);
+		static void on_control(void* param, const OOBase::RefPtr<OOBase::Buffer>& buffer, int err);
+
+		int kick();
+		void ring_bell(int fd);
+		void protocol_error();
+		bool process_recv(OOBase::Queue<RecvNotify,OOBase::AllocatorInstance>& notify_queue);
+		bool process_send(OOBase::Queue<SendNotify,OOBase::AllocatorInstance>& notify_queue);
+		void free_send(SendItem& item);
+
+		virtual void destroy()
+		{
+			OOBase::CrtAllocator::delete_free(this);
+		}
+	};
+
+	size_t segment_size(size_t ring_size)
+	{
+		return sizeof(ShmHeader) + 2 * ring_size;
+	}
+
+	// The client seals the segment, so it cannot be resized under our mapping
+	const int ShmSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+	bool valid_ring_size(size_t ring_size)
+	{
+		return (ring_size >= MinRingSize && ring_size <= MaxRingSize && (ring_size & (ring_size - 1)) == 0);
+	}
+
+	int wait_for_read(int fd, const OOBase::Timeout& timeout)
+	{
+		// The async recv() cannot be abandoned, so only start it once the reply has arrived
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int count = 0;
+		do
+		{
+			count = ::poll(&pfd,1,timeout.millisecs());
+		}
+		while (count == -1 && errno == EINTR);
+
+		if (count == -1)
+			return errno;
+
+		return (count == 0 ? ETIMEDOUT : 0);
+	}
+}
+
+ShmAsyncSocket::ShmAsyncSocket(OOBase::detail::ProactorPosix* pProactor, OOBase::AsyncSocket* pControl, void* map, size_t map_len, bool bServer, int my_bell, int peer_bell) :
+		m_pProactor(pProactor),
+		m_ptrControl(pControl),
+		m_map(map),
+		m_map_len(map_len),
+		m_my_bell(my_bell),
+		m_peer_bell(peer_bell),
+		m_closed(false),
+		m_stats_enabled(false)
+{
+	memset(&m_stats,0,sizeof(m_stats));
+
+	ShmHeader* header = static_cast<ShmHeader*>(map);
+	OOBase::uint8_t* data = static_cast<OOBase::uint8_t*>(map) + sizeof(ShmHeader);
+
+	// map_len was computed from the validated ring size, the header copy is the peer's to scribble on
+	size_t ring_size = (map_len - sizeof(ShmHeader)) / 2;
+
+	ShmRingEnd& c2s = (bServer ? m_rx : m_tx);
+	ShmRingEnd& s2c = (bServer ? m_tx : m_rx);
+	c2s.init(&header->m_rings[0],data,ring_size);
+	s2c.init(&header->m_rings[1],data + ring_size,ring_size);
+}
+
+ShmAsyncSocket::~ShmAsyncSocket()
+{
+	m_pProactor->unbind_fd(m_my_bell);
+	POSIX::close(m_my_bell);
+	POSIX::close(m_peer_bell);
+
+	munmap(m_map,m_map_len);
+
+	RecvItem recv_item;
+	while (m_recv_queue.pop(&recv_item))
+		recv_item.m_buffer->release();
+
+	SendItem send_item;
+	while (m_send_queue.pop(&send_item))
+		free_send(send_item);
+}
+
+int ShmAsyncSocket::init()
+{
+	int err = m_pProactor->bind_fd(m_my_bell,this,&fd_callback);
+	if (err)
+		return err;
+
+	// Watch the control socket for the peer closing
+	m_control_buffer = OOBase::Buffer::create(1);
+	if (!m_control_buffer)
+		return ERROR_OUTOFMEMORY;
+
+	return m_ptrControl->recv(static_cast<void*>(this),&on_control,m_control_buffer,0);
+}
+
+void ShmAsyncSocket::free_send(SendItem& item)
+{
+	if (item.m_count == 1)
+		item.m_buffer->release();
+	else
+	{
+		for (size_t i = 0; i < item.m_count; ++i)
+			item.m_buffers[i]->release();
+
+		m_pProactor->get_internal_allocator().free(item.m_buffers);
+	}
+}
+
+void ShmAsyncSocket::ring_bell(int fd)
+{
+	// Called with m_lock held
+	if (m_stats_enabled)
+		++m_stats.m_syscalls;
+
+	eventfd_write(fd,1);
+}
+
+void ShmAsyncSocket::protocol_error()
+{
+	// Called with m_lock held, the peer cannot be trusted with the segment any more
+	m_closed = true;
+	m_ptrControl->shutdown(true,true);
+}
+
+int ShmAsyncSocket::kick()
+{
+	// Get the Proactor thread to process our queues
+	ring_bell(m_my_bell);
+	return m_pProactor->watch_fd(m_my_bell,OOBase::detail::eTXRecv);
+}
+
+int ShmAsyncSocket::recv(void* param, recv_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& buffer, size_t bytes)
+{
+	int err = 0;
+	if (bytes)
+	{
+		if (!buffer)
+			return EINVAL;
+
+		err = buffer->space(bytes);
+		if (err)
+			return err;
+	}
+	else if (!buffer || !buffer->space())
+		return 0;
+
+	if (!callback)
+		return EINVAL;
+
+	RecvItem item = { param, callback, buffer.addref(), bytes };
+
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	bool watch = m_recv_queue.empty();
+	if (!m_recv_queue.push(item))
+	{
+		item.m_buffer->release();
+		return ERROR_OUTOFMEMORY;
+	}
+
+	if (++m_stats.m_recv_queue > m_stats.m_recv_queue_max)
+		m_stats.m_recv_queue_max = m_stats.m_recv_queue;
+
+	return (watch ? kick() : 0);
+}
+
+int ShmAsyncSocket::recv_msg(void*, recv_msg_callback_t, const OOBase::RefPtr<OOBase::Buffer>&, const OOBase::RefPtr<OOBase::Buffer>&, size_t)
+{
+	// There is no ancillary data channel over shared memory
+	return ENOTSUP;
+}
+
+int ShmAsyncSocket::send(void* param, send_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& buffer)
+{
+	if (!buffer || !buffer->length())
+		return 0;
+
+	SendItem item = { param, 1, buffer.addref(), NULL, callback, NULL };
+
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	bool watch = m_send_queue.empty();
+	if (!m_send_queue.push(item))
+	{
+		item.m_buffer->release();
+		return ERROR_OUTOFMEMORY;
+	}
+
+	if (++m_stats.m_send_queue > m_stats.m_send_queue_max)
+		m_stats.m_send_queue_max = m_stats.m_send_queue;
+
+	return (watch ? kick() : 0);
+}
+
+int ShmAsyncSocket::send_v(void* param, send_v_callback_t callback, OOBase::Buffer* buffers[], size_t count)
+{
+	if (!count)
+		return 0;
+
+	if (!buffers)
+		return EINVAL;
+
+	if (count == 1)
+	{
+		// Send a single buffer, reporting back through the vector callback
+		SendItem item = { param, 1, buffers[0]->addref(), NULL, NULL, callback };
+
+		OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+		bool watch = m_send_queue.empty();
+		if (!m_send_queue.push(item))
+		{
+			item.m_buffer->release();
+			return ERROR_OUTOFMEMORY;
+		}
+
+		if (++m_stats.m_send_queue > m_stats.m_send_queue_max)
+			m_stats.m_send_queue_max = m_stats.m_send_queue;
+
+		return (watch ? kick() : 0);
+	}
+
+	SendItem item = { param, count, NULL, NULL, NULL, callback };
+	item.m_buffers = static_cast<OOBase::Buffer**>(m_pProactor->get_internal_allocator().allocate(count * sizeof(OOBase::Buffer*),OOBase::alignment_of<OOBase::Buffer*>::value));
+	if (!item.m_buffers)
+		return ERROR_OUTOFMEMORY;
+
+	for (size_t i = 0; i < count; ++i)
+		item.m_buffers[i] = buffers[i]->addref();
+
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	bool watch = m_send_queue.empty();
+	if (!m_send_queue.push(item))
+	{
+		free_send(item);
+		return ERROR_OUTOFMEMORY;
+	}
+
+	if (++m_stats.m_send_queue > m_stats.m_send_queue_max)
+		m_stats.m_send_queue_max = m_stats.m_send_queue;
+
+	return (watch ? kick() : 0);
+}
+
+int ShmAsyncSocket::send_msg(void*, send_msg_callback_t, const OOBase::RefPtr<OOBase::Buffer>&, const OOBase::RefPtr<OOBase::Buffer>&)
+{
+	// There is no ancillary data channel over shared memory
+	return ENOTSUP;
+}
+
+int ShmAsyncSocket::shutdown(bool bSend, bool bRecv)
+{
+	return m_ptrControl->shutdown(bSend,bRecv);
+}
+
+OOBase::socket_t ShmAsyncSocket::get_handle() const
+{
+	return m_ptrControl->get_handle();
+}
+
+int ShmAsyncSocket::enable_stats(bool enable)
+{
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	m_stats_enabled = enable;
+	return 0;
+}
+
+int ShmAsyncSocket::get_stats(OOBase::AsyncSocketStats& stats)
+{
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	stats = m_stats;
+	return 0;
+}
+
+int ShmAsyncSocket::set_options(const OOBase::SocketOptions&)
+{
+	// There is no TCP stack under the rings
+	return ENOTSUP;
+}
+
+int ShmAsyncSocket::set_watermarks(size_t, size_t, void*, watermark_callback_t)
+{
+	return ENOTSUP;
+}
+
+void ShmAsyncSocket::on_control(void* param, const OOBase::RefPtr<OOBase::Buffer>&, int)
+{
+	// The peer never writes to the control socket, so any completion means it has gone
+	ShmAsyncSocket* pThis = static_cast<ShmAsyncSocket*>(param);
+
+	OOBase::Guard<OOBase::Mutex> guard(pThis->m_lock);
+
+	pThis->m_closed = true;
+	pThis->kick();
+}
+
+bool ShmAsyncSocket::process_recv(OOBase::Queue<RecvNotify,OOBase::AllocatorInstance>& notify_queue)
+{
+	bool signal_peer = false;
+	while (!m_recv_queue.empty())
+	{
+		RecvItem* item = m_recv_queue.front();
+
+		int err = 0;
+		size_t got = (item->m_bytes ? item->m_bytes : item->m_buffer->space());
+		if (!m_rx.read(item->m_buffer->wr_ptr(),got))
+		{
+			protocol_error();
+			err = EPROTO;
+			got = 0;
+		}
+		else if (got)
+		{
+			item->m_buffer->wr_ptr(got);
+			if (m_stats_enabled)
+				m_stats.m_bytes_in += got;
+
+			if (m_rx.wake_producer())
+				signal_peer = true;
+
+			if (item->m_bytes)
+				item->m_bytes -= got;
+		}
+
+		size_t avail = 0;
+		bool done = (err || (item->m_bytes ? false : got != 0));
+		if (!done)
+		{
+			if (m_closed && (!m_rx.readable(avail) || !avail))
+				done = true;
+			else if (!got)
+			{
+				if (m_rx.wait_readable())
+				{
+					if (m_stats_enabled)
+						++m_stats.m_eagain;
+					break;
+				}
+				continue;
+			}
+			else
+				continue;
+		}
+
+		RecvNotify notify = { err };
+		m_recv_queue.pop(&notify.m_item);
+		--m_stats.m_recv_queue;
+
+		if (!notify_queue.push(notify))
+		{
+			// Not much we can do here...
+			notify.m_item.m_buffer->release();
+		}
+	}
+
+	return signal_peer;
+}
+
+bool ShmAsyncSocket::process_send(OOBase::Queue<SendNotify,OOBase::AllocatorInstance>& notify_queue)
+{
+	bool signal_peer = false;
+	while (!m_send_queue.empty())
+	{
+		SendItem* item = m_send_queue.front();
+
+		int err = 0;
+		bool done = true;
+		if (m_closed)
+			err = EPIPE;
+		else
+		{
+			OOBase::Buffer** buffers = (item->m_count == 1 ? &item->m_buffer : item->m_buffers);
+			for (size_t i = 0; i < item->m_count; ++i)
+			{
+				size_t len = buffers[i]->length();
+				if (!len)
+					continue;
+
+				size_t sent = len;
+				if (!m_tx.write(buffers[i]->rd_ptr(),sent))
+				{
+					protocol_error();
+					err = EPROTO;
+					break;
+				}
+
+				if (sent)
+				{
+					buffers[i]->rd_ptr(sent);
+					if (m_stats_enabled)
+						m_stats.m_bytes_out += sent;
+
+					if (m_tx.wake_consumer())
+						signal_peer = true;
+				}
+
+				if (sent < len)
+				{
+					done = false;
+					break;
+				}
+			}
+		}
+
+		if (!done)
+		{
+			if (m_tx.wait_writable())
+			{
+				if (m_stats_enabled)
+					++m_stats.m_eagain;
+				break;
+			}
+			continue;
+		}
+
+		SendNotify notify = { err };
+		m_send_queue.pop(&notify.m_item);
+		--m_stats.m_send_queue;
+
+		if (!notify_queue.push(notify))
+		{
+			// Not much we can do here...
+			free_send(notify.m_item);
+		}
+	}
+
+	return signal_peer;
+}
+
+void ShmAsyncSocket::fd_callback(int fd, void* param, unsigned int)
+{
+	ShmAsyncSocket* pThis = static_cast<ShmAsyncSocket*>(param);
+	if (pThis->m_my_bell != fd)
+		OOBase_CallCriticalFailure("Wrong fd passed to callback");
+
+	// Reset the bell, it is non-blocking
+	eventfd_t val = 0;
+	eventfd_read(fd,&val);
+
+	OOBase::StackAllocator<512> allocator;
+	OOBase::Queue<RecvNotify,OOBase::AllocatorInstance> recv_notify_queue(allocator);
+	OOBase::Queue<SendNotify,OOBase::AllocatorInstance> send_notify_queue(allocator);
+
+	OOBase::Guard<OOBase::Mutex> guard(pThis->m_lock);
+
+	if (pThis->m_stats_enabled)
+		++pThis->m_stats.m_syscalls;
+
+	bool signal_peer = pThis->process_recv(recv_notify_queue);
+	if (pThis->process_send(send_notify_queue))
+		signal_peer = true;
+
+	if (signal_peer)
+		pThis->ring_bell(pThis->m_peer_bell);
+
+	// One-shot, so watch again while there is more to do
+	if (!pThis->m_recv_queue.empty() || !pThis->m_send_queue.empty())
+		pThis->m_pProactor->watch_fd(fd,OOBase::detail::eTXRecv);
+
+	guard.release();
+
+	RecvNotify recv_notify;
+	while (recv_notify_queue.pop(&recv_notify))
+	{
+		// Hand our reference to the callback
+		OOBase::RefPtr<OOBase::Buffer> buffer(recv_notify.m_item.m_buffer);
+		(*recv_notify.m_item.m_callback)(recv_notify.m_item.m_param,buffer,recv_notify.m_err);
+	}
+
+	SendNotify send_notify;
+	while (send_notify_queue.pop(&send_notify))
+	{
+		if (send_notify.m_item.m_v_callback)
+		{
+			OOBase::Buffer** buffers = (send_notify.m_item.m_count == 1 ? &send_notify.m_item.m_buffer : send_notify.m_item.m_buffers);
+			(*send_notify.m_item.m_v_callback)(send_notify.m_item.m_param,buffers,send_notify.m_item.m_count,send_notify.m_err);
+		}
+		else if (send_notify.m_item.m_callback)
+		{
+			OOBase::RefPtr<OOBase::Buffer> buffer(send_notify.m_item.m_buffer->addref());
+			(*send_notify.m_item.m_callback)(send_notify.m_item.m_param,buffer,send_notify.m_err);
+		}
+
+		pThis->free_send(send_notify.m_item);
+	}
+}
+
+namespace
+{
+	// Completes the server side of the handshake on an accepted local socket
+	class ShmHandshake
+	{
+	public:
+		ShmHandshake(OOBase::detail::ProactorPosix* pProactor, OOBase::AsyncSocket* pSocket, void* param, OOBase::Proactor::accept_pipe_callback_t callback) :
+				m_pProactor(pProactor),
+				m_ptrSocket(pSocket),
+				m_param(param),
+				m_callback(callback)
+		{}
+
+		int start()
+		{
+			m_data = OOBase::Buffer::create(sizeof(ShmHello));
+			m_ctl = OOBase::Buffer::create(CMSG_SPACE(3 * sizeof(int)));
+			if (!m_data || !m_ctl)
+				return ERROR_OUTOFMEMORY;
+
+			return m_ptrSocket->recv_msg(static_cast<void*>(this),&on_hello,m_data,m_ctl,sizeof(ShmHello));
+		}
+
+	private:
+		OOBase::detail::ProactorPosix*            m_pProactor;
+		OOBase::RefPtr<OOBase::AsyncSocket>       m_ptrSocket;
+		void*                                     m_param;
+		OOBase::Proactor::accept_pipe_callback_t  m_callback;
+		OOBase::RefPtr<OOBase::Buffer>            m_data;
+		OOBase::RefPtr<OOBase::Buffer>            m_ctl;
+
+		static void on_hello(void* param, const OOBase::RefPtr<OOBase::Buffer>& data_buffer, const OOBase::RefPtr<OOBase::Buffer>& ctl_buffer, int err)
+		{
+			ShmHandshake* pThis = static_cast<ShmHandshake*>(param);
+
+			OOBase::AsyncSocket* pSocket = NULL;
+			if (!err)
+				pSocket = pThis->complete(data_buffer,ctl_buffer,err);
+
+			// Best effort, the client is waiting for our answer
+			OOBase::RefPtr<OOBase::Buffer> ack = OOBase::Buffer::create(sizeof(ShmAck));
+			if (ack)
+			{
+				ShmAck val = static_cast<ShmAck>(err);
+				memcpy(ack->wr_ptr(),&val,sizeof(val));
+				ack->wr_ptr(sizeof(val));
+				pThis->m_ptrSocket->send(static_cast<void*>(NULL),static_cast<OOBase::AsyncSocket::send_callback_t>(NULL),ack);
+			}
+
+			OOBase::Proactor::accept_pipe_callback_t callback = pThis->m_callback;
+			void* cb_param = pThis->m_param;
+			OOBase::CrtAllocator::delete_free(pThis);
+
+			(*callback)(cb_param,pSocket,err);
+		}
+
+		OOBase::AsyncSocket* complete(const OOBase::RefPtr<OOBase::Buffer>& data_buffer, const OOBase::RefPtr<OOBase::Buffer>& ctl_buffer, int& err)
+		{
+			// Collect any passed descriptors, so we never leak them
+			int fds[3] = { -1, -1, -1 };
+			size_t fd_count = 0;
+
+			struct msghdr msg = {0};
+			msg.msg_control = const_cast<OOBase::uint8_t*>(ctl_buffer->rd_ptr());
+			msg.msg_controllen = ctl_buffer->length();
+			for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg,cmsg))
+			{
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+				{
+					size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+					const int* p = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+					for (size_t i = 0; i < count; ++i)
+					{
+						int fd;
+						memcpy(&fd,p + i,sizeof(int));
+						if (fd_count < 3)
+							fds[fd_count++] = fd;
+						else
+							POSIX::close(fd);
+					}
+				}
+			}
+
+			ShmHello hello = {0};
+			if (data_buffer->length() == sizeof(hello))
+				memcpy(&hello,data_buffer->rd_ptr(),sizeof(hello));
+
+			void* map = MAP_FAILED;
+			size_t map_len = segment_size(hello.m_ring_size);
+			struct stat st = {0};
+			int seals = 0;
+
+			if (fd_count != 3 || hello.m_magic != ShmMagic || !valid_ring_size(hello.m_ring_size))
+				err = EPROTO;
+			else if ((seals = fcntl(fds[0],F_GET_SEALS)) == -1)
+				err = (errno == EINVAL ? EPROTO : errno);
+			else if ((seals & ShmSeals) != ShmSeals)
+				err = EPROTO;
+			else if (fstat(fds[0],&st) != 0)
+				err = errno;
+			else if (static_cast<size_t>(st.st_size) != map_len)
+				err = EPROTO;
+			else if ((map = mmap(NULL,map_len,PROT_READ | PROT_WRITE,MAP_SHARED,fds[0],0)) == MAP_FAILED)
+				err = errno;
+			else
+			{
+				ShmHeader* header = static_cast<ShmHeader*>(map);
+				if (header->m_magic != ShmMagic || header->m_ring_size != hello.m_ring_size)
+					err = EPROTO;
+				else
+					err = POSIX::set_non_blocking(fds[1],true);
+			}
+
+			if (fds[0] != -1)
+				POSIX::close(fds[0]);
+
+			ShmAsyncSocket* pSocket = NULL;
+			if (!err)
+			{
+				// The client rings fds[1] for us, and waits on fds[2]
+				if (!OOBase::CrtAllocator::allocate_new(pSocket,m_pProactor,m_ptrSocket.addref(),map,map_len,true,fds[1],fds[2]))
+				{
+					m_ptrSocket->release();
+					err = ERROR_OUTOFMEMORY;
+				}
+				else if ((err = pSocket->init()) != 0)
+				{
+					// The socket owns the descriptors and mapping now
+					pSocket->release();
+					return NULL;
+				}
+				else
+					return pSocket;
+			}
+
+			if (map != MAP_FAILED)
+				munmap(map,map_len);
+			if (fds[1] != -1)
+				POSIX::close(fds[1]);
+			if (fds[2] != -1)
+				POSIX::close(fds[2]);
+
+			return NULL;
+		}
+	};
+
+	class ShmAcceptor : public OOBase::Acceptor
+	{
+	public:
+		ShmAcceptor(OOBase::detail::ProactorPosix* pProactor, void* param, OOBase::Proactor::accept_pipe_callback_t callback) :
+				m_pProactor(pProactor),
+				m_param(param),
+				m_callback(callback)
+		{}
+
+		int bind(const char* path, SECURITY_ATTRIBUTES* psa)
+		{
+			int err = 0;
+			m_ptrAcceptor = m_pProactor->accept(static_cast<void*>(this),&on_accept,path,err,psa);
+			return err;
+		}
+
+	private:
+		OOBase::detail::ProactorPosix*           m_pProactor;
+		void*                                    m_param;
+		OOBase::Proactor::accept_pipe_callback_t m_callback;
+		OOBase::RefPtr<OOBase::Acceptor>         m_ptrAcceptor;
+
+		static void on_accept(void* param, OOBase::AsyncSocket* pSocket, int err)
+		{
+			ShmAcceptor* pThis = static_cast<ShmAcceptor*>(param);
+			if (err)
+			{
+				(*pThis->m_callback)(pThis->m_param,NULL,err);
+				return;
+			}
+
+			ShmHandshake* pHandshake = NULL;
+			if (!OOBase::CrtAllocator::allocate_new(pHandshake,pThis->m_pProactor,pSocket,pThis->m_param,pThis->m_callback))
+			{
+				pSocket->release();
+				(*pThis->m_callback)(pThis->m_param,NULL,ERROR_OUTOFMEMORY);
+			}
+			else if ((err = pHandshake->start()) != 0)
+			{
+				OOBase::CrtAllocator::delete_free(pHandshake);
+				(*pThis->m_callback)(pThis->m_param,NULL,err);
+			}
+		}
+
+		virtual void destroy()
+		{
+			OOBase::CrtAllocator::delete_free(this);
+		}
+	};
+}
+
+OOBase::Acceptor* OOBase::detail::ProactorPosix::accept_shared(void* param, accept_pipe_callback_t callback, const char* path, int& err, SECURITY_ATTRIBUTES* psa)
+{
+	// Make sure we have valid inputs
+	if (!callback || !path)
+	{
+		err = EINVAL;
+		return NULL;
+	}
+
+	ShmAcceptor* pAcceptor = NULL;
+	if (!OOBase::CrtAllocator::allocate_new(pAcceptor,this,param,callback))
+		err = ENOMEM;
+	else
+	{
+		err = pAcceptor->bind(path,psa);
+		if (err != 0)
+		{
+			pAcceptor->release();
+			pAcceptor = NULL;
+		}
+	}
+
+	return pAcceptor;
+}
+
+OOBase::AsyncSocket* OOBase::detail::ProactorPosix::connect_shared(const char* path, int& err, const Timeout& timeout, size_t ring_size)
+{
+	if (!ring_size)
+		ring_size = DefaultRingSize;
+
+	// Round up to a power of 2
+	size_t size = MinRingSize;
+	while (size < ring_size && size < MaxRingSize)
+		size <<= 1;
+	ring_size = size;
+
+	RefPtr<AsyncSocket> ptrControl(connect(path,err,timeout));
+	if (!ptrControl)
+		return NULL;
+
+	size_t map_len = segment_size(ring_size);
+	void* map = MAP_FAILED;
+	int bells[2] = { -1, -1 };
+
+	int memfd = memfd_create("oonet-shm",MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd == -1)
+		err = errno;
+	else if (ftruncate(memfd,map_len) != 0)
+		err = errno;
+	else if (fcntl(memfd,F_ADD_SEALS,ShmSeals) != 0)
+		err = errno;
+	else if ((map = mmap(NULL,map_len,PROT_READ | PROT_WRITE,MAP_SHARED,memfd,0)) == MAP_FAILED)
+		err = errno;
+	else if ((bells[0] = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC)) == -1 || (bells[1] = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		err = errno;
+	else
+	{
+		// ftruncate() zero fills, so only the header needs setting
+		ShmHeader* header = static_cast<ShmHeader*>(map);
+		header->m_magic = ShmMagic;
+		header->m_ring_size = static_cast<uint32_t>(ring_size);
+
+		RefPtr<Buffer> data = Buffer::create(sizeof(ShmHello));
+		RefPtr<Buffer> ctl = Buffer::create(CMSG_SPACE(3 * sizeof(int)));
+		RefPtr<Buffer> ack = Buffer::create(sizeof(ShmAck));
+		if (!data || !ctl || !ack)
+			err = ERROR_OUTOFMEMORY;
+		else
+		{
+			ShmHello hello = { ShmMagic, static_cast<uint32_t>(ring_size) };
+			memcpy(data->wr_ptr(),&hello,sizeof(hello));
+			data->wr_ptr(sizeof(hello));
+
+			// The server is passed the segment, its bell and ours
+			memset(ctl->wr_ptr(),0,CMSG_SPACE(3 * sizeof(int)));
+			struct cmsghdr* cmsg = reinterpret_cast<struct cmsghdr*>(ctl->wr_ptr());
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+			int fds[3] = { memfd, bells[0], bells[1] };
+			memcpy(CMSG_DATA(cmsg),fds,sizeof(fds));
+			ctl->wr_ptr(CMSG_SPACE(3 * sizeof(int)));
+
+			err = ptrControl->send_msg(data,ctl);
+			if (!err)
+				err = wait_for_read(ptrControl->get_handle(),timeout);
+			if (!err)
+				err = ptrControl->recv(ack,sizeof(ShmAck));
+			if (!err)
+			{
+				ShmAck val = 0;
+				if (ack->length() != sizeof(val))
+					err = EPROTO;
+				else
+				{
+					memcpy(&val,ack->rd_ptr(),sizeof(val));
+					err = static_cast<int>(val);
+				}
+			}
+		}
+	}
+
+	if (memfd != -1)
+		POSIX::close(memfd);
+
+	if (!err)
+	{
+		// We ring bells[0] for the server, and wait on bells[1]
+		ShmAsyncSocket* pSocket = NULL;
+		if (!OOBase::CrtAllocator::allocate_new(pSocket,this,ptrControl.addref(),map,map_len,false,bells[1],bells[0]))
+		{
+			ptrControl->release();
+			err = ERROR_OUTOFMEMORY;
+		}
+		else
+		{
+			// The socket owns the descriptors and mapping now
+			err = pSocket->init();
+			if (err)
+			{
+				pSocket->release();
+				pSocket = NULL;
+			}
+			return pSocket;
+		}
+	}
+
+	if (map != MAP_FAILED)
+		munmap(map,map_len);
+	if (bells[0] != -1)
+		POSIX::close(bells[0]);
+	if (bells[1] != -1)
+		POSIX::close(bells[1]);
+
+	return NULL;
+}
+
+#else // defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_EVENTFD_H) && defined(HAVE_SYS_MMAN_H)
+
+OOBase::Acceptor* OOBase::detail::ProactorPosix::accept_shared(void*, accept_pipe_callback_t, const char*, int& err, SECURITY_ATTRIBUTES*)
+{
+	err = ENOTSUP;
+	return NULL;
+}
+
+OOBase::AsyncSocket* OOBase::detail::ProactorPosix::connect_shared(const char*, int& err, const Timeout&, size_t)
+{
+	err = ENOTSUP;
+	return NULL;
+}
+
+#endif
+
+#endif // defined(HAVE_UNISTD_H)
@@ -29,8 +29,17 @@
 #if defined(HAVE_UNISTD_H)
 
 #include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string.h>
 
+// BSD calls TCP_CORK TCP_NOPUSH
+#if defined(TCP_CORK)
+#define OOBASE_TCP_CORK TCP_CORK
+#elif defined(TCP_NOPUSH)
+#define OOBASE_TCP_CORK TCP_NOPUSH
+#endif
+
 #if !defined(MSG_NOSIGNAL)
 #if (defined(__APPLE__) || defined(__MACH__))
 #define MSG_NOSIGNAL SO_NOSIGPIPE
@@ -56,6 +65,10 @@ namespace
 		int send_msg(void* param, send_msg_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& data_buffer, const OOBase::RefPtr<OOBase::Buffer>& ctl_buffer);
 		int shutdown(bool bSend, bool bRecv);
 		OOBase::socket_t get_handle() const;
+		int enable_stats(bool enable);
+		int get_stats(OOBase::AsyncSocketStats& stats);
+		int set_options(const OOBase::SocketOptions& options);
+		int set_watermarks(size_t high, size_t low, void* param, watermark_callback_t callback);
 
 	protected:
 		OOBase::AllocatorInstance& get_internal_allocator() const
@@ -77,6 +90,15 @@ namespace
 			};
 		};
 
+		// What is left of this wakeup's share of the thread
+		struct RecvBudget
+		{
+			size_t m_bytes;
+			size_t m_ops;
+
+			bool spend(ssize_t r);
+		};
+
 		struct RecvNotify
 		{
 			int             m_err;
@@ -102,6 +124,7 @@ namespace
 				send_v_callback_t   m_v_callback;
 				send_msg_callback_t m_msg_callback;
 			};
+			size_t          m_bytes;
 		};
 
 		struct SendNotify
@@ -115,16 +138,35 @@ namespace
 		OOBase::Mutex                  m_lock;
 		OOBase::Queue<RecvItem>        m_recv_queue;
 		OOBase::Queue<SendItem>        m_send_queue;
+		bool                           m_stats_enabled;
+		OOBase::AsyncSocketStats       m_stats;
+		OOBase::uint64_t               m_send_wait_start;
+		bool                           m_quickack;
+		bool                           m_cork;
+		bool                           m_corked;
+		size_t                         m_wm_high;
+		size_t                         m_wm_low;
+		void*                          m_wm_param;
+		watermark_callback_t           m_wm_callback;
+		bool                           m_wm_above;
+		bool                           m_wm_notified;
+		bool                           m_wm_notifying;
 
 		static void fd_callback(int fd, void* param, unsigned int events);
 		void process_recv(OOBase::Queue<RecvNotify,OOBase::AllocatorInstance>& notify_queue);
-		int process_recv_i(RecvItem* item, bool& watch_again);
-		int process_recv_msg(RecvItem* item, bool& watch_again);
+		int process_recv_i(RecvItem* item, RecvBudget& budget, bool& watch_again);
+		int process_recv_msg(RecvItem* item, RecvBudget& budget, bool& watch_again);
 		void process_send(OOBase::Queue<SendNotify,OOBase::AllocatorInstance>& notify_queue);
 		int process_send_i(SendItem* item, bool& watch_again);
 		int process_send_v(SendItem* item, bool& watch_again);
 		int process_send_msg(SendItem* item, bool& watch_again);
 
+		void stats_io(ssize_t r, OOBase::uint64_t& bytes);
+		void stats_queued(size_t& depth, size_t& depth_max);
+		void set_cork(bool cork);
+		bool update_watermark();
+		void notify_watermark();
+
 		virtual void destroy()
 		{
 			OOBase::CrtAllocator::delete_free(this);
@@ -134,8 +176,22 @@ namespace
 
 PosixAsyncSocket::PosixAsyncSocket(OOBase::detail::ProactorPosix* pProactor, int fd) :
 		m_pProactor(pProactor),
-		m_fd(fd)
-{ }
+		m_fd(fd),
+		m_stats_enabled(false),
+		m_send_wait_start(0),
+		m_quickack(false),
+		m_cork(false),
+		m_corked(false),
+		m_wm_high(0),
+		m_wm_low(0),
+		m_wm_param(NULL),
+		m_wm_callback(NULL),
+		m_wm_above(false),
+		m_wm_notified(false),
+		m_wm_notifying(false)
+{
+	memset(&m_stats,0,sizeof(m_stats));
+}
 
 PosixAsyncSocket::~PosixAsyncSocket()
 {
@@ -179,6 +235,8 @@ PosixAsyncSocket::~PosixAsyncSocket()
 
 int PosixAsyncSocket::init()
 {
+	m_pProactor->busy_poll_socket(m_fd);
+
 	return m_pProactor->bind_fd(m_fd,this,&fd_callback);
 }
 
@@ -207,6 +265,8 @@ int PosixAsyncSocket::recv(void* param, recv_callback_t callback, const OOBase::
 
 	bool watch = m_recv_queue.empty();
 	err = m_recv_queue.push(item) ? 0 : ERROR_OUTOFMEMORY;
+	if (!err)
+		stats_queued(m_stats.m_recv_queue,m_stats.m_recv_queue_max);
 
 	guard.release();
 
@@ -244,6 +304,8 @@ int PosixAsyncSocket::recv_msg(void* param, recv_msg_callback_t callback, const
 
 	bool watch = m_recv_queue.empty();
 	err = m_recv_queue.push(item) ? 0 : ERROR_OUTOFMEMORY;
+	if (!err)
+		stats_queued(m_stats.m_recv_queue,m_stats.m_recv_queue_max);
 
 	guard.release();
 
@@ -269,11 +331,19 @@ int PosixAsyncSocket::send(void* param, send_callback_t callback, const OOBase::
 	SendItem item = { param, 1 };
 	item.m_callback = callback;
 	item.m_buffer = buffer.addref();
+	item.m_bytes = bytes;
 
 	OOBase::Guard<OOBase::Mutex> guard(m_lock);
 
 	bool watch = m_send_queue.empty();
+	bool notify = false;
 	int err = m_send_queue.push(item) ? 0 : ERROR_OUTOFMEMORY;
+	if (!err)
+	{
+		stats_queued(m_stats.m_send_queue,m_stats.m_send_queue_max);
+		m_stats.m_send_queue_bytes += item.m_bytes;
+		notify = update_watermark();
+	}
 
 	guard.release();
 
@@ -283,6 +353,9 @@ int PosixAsyncSocket::send(void* param, send_callback_t callback, const OOBase::
 		return err;
 	}
 
+	if (notify)
+		notify_watermark();
+
 	return (watch ? m_pProactor->watch_fd(m_fd,OOBase::detail::eTXSend) : 0);
 }
 
@@ -318,6 +391,7 @@ int PosixAsyncSocket::send_v(void* param, send_v_callback_t callback, OOBase::Bu
 		{
 			item.m_buffers[idx] = buffers[i];
 			item.m_buffers[idx]->addref();
+			item.m_bytes += buffers[i]->length();
 			++idx;
 		}
 	}
@@ -325,7 +399,14 @@ int PosixAsyncSocket::send_v(void* param, send_v_callback_t callback, OOBase::Bu
 	OOBase::Guard<OOBase::Mutex> guard(m_lock);
 
 	bool watch = m_send_queue.empty();
+	bool notify = false;
 	int err = m_send_queue.push(item) ? 0 : ERROR_OUTOFMEMORY;
+	if (!err)
+	{
+		stats_queued(m_stats.m_send_queue,m_stats.m_send_queue_max);
+		m_stats.m_send_queue_bytes += item.m_bytes;
+		notify = update_watermark();
+	}
 
 	guard.release();
 
@@ -338,6 +419,9 @@ int PosixAsyncSocket::send_v(void* param, send_v_callback_t callback, OOBase::Bu
 		return err;
 	}
 
+	if (notify)
+		notify_watermark();
+
 	return (watch ? m_pProactor->watch_fd(m_fd,OOBase::detail::eTXSend) : 0);
 }
 
@@ -356,11 +440,19 @@ int PosixAsyncSocket::send_msg(void* param, send_msg_callback_t callback, const
 	item.m_msg_callback = callback;
 	item.m_ctl_buffer = ctl_buffer.addref();
 	item.m_buffer = data_buffer.addref();
+	item.m_bytes = data_len + ctl_len;
 
 	OOBase::Guard<OOBase::Mutex> guard(m_lock);
 
 	bool watch = m_send_queue.empty();
+	bool notify = false;
 	int err = m_send_queue.push(item) ? 0 : ERROR_OUTOFMEMORY;
+	if (!err)
+	{
+		stats_queued(m_stats.m_send_queue,m_stats.m_send_queue_max);
+		m_stats.m_send_queue_bytes += item.m_bytes;
+		notify = update_watermark();
+	}
 
 	guard.release();
 
@@ -370,6 +462,9 @@ int PosixAsyncSocket::send_msg(void* param, send_msg_callback_t callback, const
 		return err;
 	}
 
+	if (notify)
+		notify_watermark();
+
 	return (watch ? m_pProactor->watch_fd(m_fd,OOBase::detail::eTXSend) : 0);
 }
 
@@ -391,6 +486,135 @@ OOBase::socket_t PosixAsyncSocket::get_handle() const
 	return m_fd;
 }
 
+int PosixAsyncSocket::enable_stats(bool enable)
+{
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	m_stats_enabled = enable;
+	return 0;
+}
+
+int PosixAsyncSocket::get_stats(OOBase::AsyncSocketStats& stats)
+{
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	stats = m_stats;
+	return 0;
+}
+
+int PosixAsyncSocket::set_options(const OOBase::SocketOptions& options)
+{
+	int err = OOBase::Net::set_options(m_fd,options);
+	if (err)
+		return err;
+
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	if (options.m_quickack)
+		m_quickack = (options.m_quickack == OOBase::SocketOptions::eOn);
+
+	if (options.m_cork)
+	{
+		m_cork = (options.m_cork == OOBase::SocketOptions::eOn);
+		if (!m_cork && m_corked)
+			set_cork(false);
+	}
+
+	return 0;
+}
+
+int PosixAsyncSocket::set_watermarks(size_t high, size_t low, void* param, watermark_callback_t callback)
+{
+	if (high && (low >= high || !callback))
+		return EINVAL;
+
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	m_wm_high = high;
+	m_wm_low = low;
+	m_wm_param = param;
+	m_wm_callback = (high ? callback : NULL);
+	m_wm_above = m_wm_notified = false;
+
+	// The queue may already be over the new high watermark
+	bool notify = update_watermark();
+
+	guard.release();
+
+	if (notify)
+		notify_watermark();
+
+	return 0;
+}
+
+bool PosixAsyncSocket::update_watermark()
+{
+	// Called with m_lock held, returns true if the producer needs telling
+	if (!m_wm_callback)
+		return false;
+
+	if (!m_wm_above && m_stats.m_send_queue_bytes >= m_wm_high)
+		m_wm_above = true;
+	else if (m_wm_above && m_stats.m_send_queue_bytes <= m_wm_low)
+		m_wm_above = false;
+
+	return (m_wm_above != m_wm_notified && !m_wm_notifying);
+}
+
+void PosixAsyncSocket::notify_watermark()
+{
+	// Senders and the proactor thread can both cross a watermark, so only one of them
+	// calls back at a time, and it keeps going until the producer has seen the latest state
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	while (m_wm_callback && !m_wm_notifying && m_wm_above != m_wm_notified)
+	{
+		bool above = m_wm_above;
+		void* param = m_wm_param;
+		watermark_callback_t callback = m_wm_callback;
+
+		m_wm_notified = above;
+		m_wm_notifying = true;
+
+		guard.release();
+
+		(*callback)(param,above);
+
+		guard.acquire();
+
+		m_wm_notifying = false;
+	}
+}
+
+void PosixAsyncSocket::set_cork(bool cork)
+{
+	// Called with m_lock held, best effort as the sends themselves report any socket error
+#if defined(OOBASE_TCP_CORK)
+	int val = (cork ? 1 : 0);
+	::setsockopt(m_fd,IPPROTO_TCP,OOBASE_TCP_CORK,&val,sizeof(val));
+#endif
+	m_corked = cork;
+}
+
+void PosixAsyncSocket::stats_io(ssize_t r, OOBase::uint64_t& bytes)
+{
+	// Called with m_lock held, directly after the syscall so errno is intact
+	if (m_stats_enabled)
+	{
+		++m_stats.m_syscalls;
+		if (r > 0)
+			bytes += r;
+		else if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			++m_stats.m_eagain;
+	}
+}
+
+void PosixAsyncSocket::stats_queued(size_t& depth, size_t& depth_max)
+{
+	if (++depth > depth_max)
+		depth_max = depth;
+}
+
 void PosixAsyncSocket::fd_callback(int fd, void* param, unsigned int events)
 {
 	PosixAsyncSocket* pThis = static_cast<PosixAsyncSocket*>(param);
@@ -406,11 +630,18 @@ void PosixAsyncSocket::fd_callback(int fd, void* param, unsigned int events)
 	if (events & OOBase::detail::eTXRecv)
 		pThis->process_recv(recv_notify_queue);
 
+	bool notify = false;
 	if (events & OOBase::detail::eTXSend)
+	{
 		pThis->process_send(send_notify_queue);
+		notify = pThis->update_watermark();
+	}
 
 	guard.release();
 
+	if (notify)
+		pThis->notify_watermark();
+
 	RecvNotify recv_notify;
 	while (recv_notify_queue.pop(&recv_notify))
 	{
@@ -500,13 +731,30 @@ void PosixAsyncSocket::fd_callback(int fd, void* param, unsigned int events)
 	}
 }
 
-int PosixAsyncSocket::process_recv_i(RecvItem* item, bool& watch_again)
+bool PosixAsyncSocket::RecvBudget::spend(ssize_t r)
+{
+	// Returns true once the budget is used up
+	if (r > 0)
+		m_bytes = (static_cast<size_t>(r) < m_bytes ? m_bytes - r : 0);
+
+	if (m_ops)
+		--m_ops;
+
+	return (m_bytes == 0 || m_ops == 0);
+}
+
+int PosixAsyncSocket::process_recv_i(RecvItem* item, RecvBudget& budget, bool& watch_again)
 {
 	// We read again on EOF, as we only return error codes
 	int err = 0;
 	for (;;)
 	{
 		size_t to_read = (item->m_bytes ? item->m_bytes : item->m_buffer->space());
+
+		// Never read more than the remaining budget allows
+		if (to_read > budget.m_bytes)
+			to_read = budget.m_bytes;
+
 		ssize_t r = 0;
 
 		do
@@ -515,6 +763,8 @@ int PosixAsyncSocket::process_recv_i(RecvItem* item, bool& watch_again)
 		}
 		while (r == -1 && errno == EINTR);
 
+		stats_io(r,m_stats.m_bytes_in);
+
 		if (r == -1)
 		{
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -534,6 +784,13 @@ int PosixAsyncSocket::process_recv_i(RecvItem* item, bool& watch_again)
 		if (item->m_bytes)
 			item->m_bytes -= r;
 
+		if (budget.spend(r) && item->m_bytes)
+		{
+			// Out of budget part way through, carry on at the next wakeup
+			watch_again = true;
+			break;
+		}
+
 		if (item->m_bytes == 0)
 			break;
 	}
@@ -541,9 +798,9 @@ int PosixAsyncSocket::process_recv_i(RecvItem* item, bool& watch_again)
 	return err;
 }
 
-int PosixAsyncSocket::process_recv_msg(RecvItem* item, bool& watch_again)
+int PosixAsyncSocket::process_recv_msg(RecvItem* item, RecvBudget& budget, bool& watch_again)
 {
-	// We only do a single read
+	// We only do a single read, never capped by the budget as that would split the message
 	struct iovec io = {0};
 	io.iov_base = item->m_buffer->wr_ptr();
 	io.iov_len = (item->m_bytes ? item->m_bytes : item->m_buffer->space());
@@ -573,6 +830,8 @@ int PosixAsyncSocket::process_recv_msg(RecvItem* item, bool& watch_again)
 	}
 	while (r == -1 && errno == EINTR);
 
+	stats_io(r,m_stats.m_bytes_in);
+
 	if (r == -1)
 	{
 		if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -589,11 +848,20 @@ int PosixAsyncSocket::process_recv_msg(RecvItem* item, bool& watch_again)
 			return err;
 	}
 
+	budget.spend(r);
 	return 0;
 }
 
 void PosixAsyncSocket::process_recv(OOBase::Queue<RecvNotify,OOBase::AllocatorInstance>& notify_queue)
 {
+	// Take a copy, so a change mid-wakeup cannot unbalance the budget
+	RecvBudget budget = { 0, 0 };
+	m_pProactor->recv_budget(budget.m_bytes,budget.m_ops);
+	if (!budget.m_bytes)
+		budget.m_bytes = size_t(-1);
+	if (!budget.m_ops)
+		budget.m_ops = size_t(-1);
+
 	int err = 0;
 	while (!m_recv_queue.empty())
 	{
@@ -602,13 +870,21 @@ void PosixAsyncSocket::process_recv(OOBase::Queue<RecvNotify,OOBase::AllocatorIn
 			RecvItem* front = m_recv_queue.front();
 
 			bool watch_again = false;
-			if (front->m_ctl_buffer)
-				err = process_recv_msg(front,watch_again);
+			if (!budget.m_bytes || !budget.m_ops)
+			{
+				// Spent, so give way to the other sockets until the next wakeup
+				watch_again = true;
+			}
+			else if (front->m_ctl_buffer)
+				err = process_recv_msg(front,budget,watch_again);
 			else
-				err = process_recv_i(front,watch_again);
+				err = process_recv_i(front,budget,watch_again);
 
 			if (!err && watch_again)
 			{
+				if (m_stats_enabled && (!budget.m_bytes || !budget.m_ops))
+					++m_stats.m_recv_yields;
+
 				// Watch for eTXRecv again
 				err = m_pProactor->watch_fd(m_fd,OOBase::detail::eTXRecv);
 				if (!err)
@@ -619,6 +895,7 @@ void PosixAsyncSocket::process_recv(OOBase::Queue<RecvNotify,OOBase::AllocatorIn
 		// By the time we get here, we have a complete recv or an error
 		RecvItem item;
 		m_recv_queue.pop(&item);
+		--m_stats.m_recv_queue;
 
 		RecvNotify notify;
 		notify.m_err = err;
@@ -634,6 +911,15 @@ void PosixAsyncSocket::process_recv(OOBase::Queue<RecvNotify,OOBase::AllocatorIn
 			OOBase_CallCriticalFailure(err);
 		}
 	}
+
+#if defined(TCP_QUICKACK)
+	// Linux drops back to delayed ACKs, so ask again after every read
+	if (m_quickack)
+	{
+		int val = 1;
+		::setsockopt(m_fd,IPPROTO_TCP,TCP_QUICKACK,&val,sizeof(val));
+	}
+#endif
 }
 
 int PosixAsyncSocket::process_send_i(SendItem* item, bool& watch_again)
@@ -653,6 +939,8 @@ int PosixAsyncSocket::process_send_i(SendItem* item, bool& watch_again)
 		}
 		while (sent == -1 && errno == EINTR);
 
+		stats_io(sent,m_stats.m_bytes_out);
+
 		if (sent == -1)
 		{
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -716,6 +1004,8 @@ int PosixAsyncSocket::process_send_v(SendItem* item, bool& watch_again)
 				}
 				while (sent == -1 && errno == EINTR);
 
+				stats_io(sent,m_stats.m_bytes_out);
+
 				if (sent == -1)
 				{
 					if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -779,6 +1069,8 @@ int PosixAsyncSocket::process_send_msg(SendItem* item, bool& watch_again)
 	}
 	while (sent == -1 && errno == EINTR);
 
+	stats_io(sent,m_stats.m_bytes_out);
+
 	if (sent == -1)
 	{
 		if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -797,6 +1089,18 @@ int PosixAsyncSocket::process_send_msg(SendItem* item, bool& watch_again)
 
 void PosixAsyncSocket::process_send(OOBase::Queue<SendNotify,OOBase::AllocatorInstance>& notify_queue)
 {
+	if (m_send_wait_start)
+	{
+		// We are writable again after an EAGAIN
+		if (m_stats_enabled)
+			m_stats.m_send_wait_usecs += OOBase::detail::ProactorPosix::stats_clock() - m_send_wait_start;
+		m_send_wait_start = 0;
+	}
+
+	// With more than one send queued, hold partial segments back until the queue drains
+	if (m_cork && !m_corked && m_stats.m_send_queue > 1)
+		set_cork(true);
+
 	int err = 0;
 	while (!m_send_queue.empty())
 	{
@@ -817,6 +1121,9 @@ void PosixAsyncSocket::process_send(OOBase::Queue<SendNotify,OOBase::AllocatorIn
 
 			if (!err && watch_again)
 			{
+				if (m_stats_enabled)
+					m_send_wait_start = OOBase::detail::ProactorPosix::stats_clock();
+
 				// Watch for eTXRecv again
 				err = m_pProactor->watch_fd(m_fd,OOBase::detail::eTXSend);
 				if (!err)
@@ -827,6 +1134,8 @@ void PosixAsyncSocket::process_send(OOBase::Queue<SendNotify,OOBase::AllocatorIn
 		// By the time we get here, we have a complete send or an error
 		SendItem item;
 		m_send_queue.pop(&item);
+		--m_stats.m_send_queue;
+		m_stats.m_send_queue_bytes -= item.m_bytes;
 
 		SendNotify notify;
 		notify.m_err = err;
@@ -855,6 +1164,10 @@ void PosixAsyncSocket::process_send(OOBase::Queue<SendNotify,OOBase::AllocatorIn
 			OOBase_CallCriticalFailure(err);
 		}
 	}
+
+	// Drained, so flush whatever partial segment is left
+	if (m_corked && m_send_queue.empty())
+		set_cork(false);
 }
 
 namespace
@@ -866,7 +1179,7 @@ namespace
 		SocketAcceptor(OOBase::detail::ProactorPosix* pProactor, void* param, OOBase::Proactor::accept_pipe_callback_t callback);
 		virtual ~SocketAcceptor();
 
-		int bind(const sockaddr* addr, socklen_t addr_len, SECURITY_ATTRIBUTES& sa);
+		int bind(const sockaddr* addr, socklen_t addr_len, SECURITY_ATTRIBUTES& sa, const OOBase::SocketOptions* options = NULL);
 
 	private:
 		OOBase::detail::ProactorPosix*           m_pProactor;
@@ -875,6 +1188,8 @@ namespace
 		OOBase::Proactor::accept_pipe_callback_t m_callback_local;
 		SECURITY_ATTRIBUTES                      m_sa;
 		int                                      m_fd;
+		bool                                     m_has_options;
+		OOBase::SocketOptions                    m_options;
 
 		static void fd_callback(int fd, void* param, unsigned int events);
 
@@ -890,16 +1205,22 @@ SocketAcceptor::SocketAcceptor(OOBase::detail::ProactorPosix* pProactor, void* p
 		m_param(param),
 		m_callback(callback),
 		m_callback_local(NULL),
-		m_fd(-1)
-{ }
+		m_fd(-1),
+		m_has_options(false)
+{
+	memset(&m_options,0,sizeof(m_options));
+}
 
 SocketAcceptor::SocketAcceptor(OOBase::detail::ProactorPosix* pProactor, void* param, OOBase::Proactor::accept_pipe_callback_t callback) :
 		m_pProactor(pProactor),
 		m_param(param),
 		m_callback(NULL),
 		m_callback_local(callback),
-		m_fd(-1)
-{ }
+		m_fd(-1),
+		m_has_options(false)
+{
+	memset(&m_options,0,sizeof(m_options));
+}
 
 SocketAcceptor::~SocketAcceptor()
 {
@@ -910,7 +1231,7 @@ SocketAcceptor::~SocketAcceptor()
 	}
 }
 
-int SocketAcceptor::bind(const sockaddr* addr, socklen_t addr_len, SECURITY_ATTRIBUTES& sa)
+int SocketAcceptor::bind(const sockaddr* addr, socklen_t addr_len, SECURITY_ATTRIBUTES& sa, const OOBase::SocketOptions* options)
 {
 	// Create a new socket
 	int err = 0;
@@ -920,10 +1241,36 @@ int SocketAcceptor::bind(const sockaddr* addr, socklen_t addr_len, SECURITY_ATTR
 
 	m_sa = sa;
 
+	int backlog = SOMAXCONN;
+	if (options)
+	{
+		m_options = *options;
+		m_has_options = true;
+
+		if (m_options.m_backlog > 0)
+			backlog = m_options.m_backlog;
+
+		// Accepted sockets inherit buffer sizes from the listener, and need them before the handshake to scale the window
+		if (m_options.m_sndbuf || m_options.m_rcvbuf)
+		{
+			OOBase::SocketOptions buffers;
+			memset(&buffers,0,sizeof(buffers));
+			buffers.m_sndbuf = m_options.m_sndbuf;
+			buffers.m_rcvbuf = m_options.m_rcvbuf;
+
+			err = OOBase::Net::set_options(fd,buffers);
+			if (err)
+			{
+				OOBase::Net::close_socket(fd);
+				return err;
+			}
+		}
+	}
+
 	// Apparently, chmod before bind()
 
 	// Bind to the address
-	if ((m_sa.mode && ::fchmod(fd,m_sa.mode) != 0) || ::bind(fd,addr,addr_len) != 0 || ::listen(fd,SOMAXCONN) != 0)
+	if ((m_sa.mode && ::fchmod(fd,m_sa.mode) != 0) || ::bind(fd,addr,addr_len) != 0 || ::listen(fd,backlog) != 0)
 		err = errno;
 	else
 	{
@@ -1039,6 +1386,8 @@ void SocketAcceptor::fd_callback(int fd, void* param, unsigned int events)
 				else
 				{
 					err = pSocket->init();
+					if (!err && pThis->m_has_options)
+						err = pSocket->set_options(pThis->m_options);
 					if (err != 0)
 					{
 						pSocket->release();
@@ -1064,7 +1413,7 @@ void SocketAcceptor::fd_callback(int fd, void* param, unsigned int events)
 	}
 }
 
-OOBase::Acceptor* OOBase::detail::ProactorPosix::accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err)
+OOBase::Acceptor* OOBase::detail::ProactorPosix::accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err, const SocketOptions* options)
 {
 	// Make sure we have valid inputs
 	if (!callback || !addr || addr_len == 0)
@@ -1082,7 +1431,7 @@ OOBase::Acceptor* OOBase::detail::ProactorPosix::accept(void* param, accept_call
 		defaults.mode = 0;
 		defaults.pass_credentials = false;
 
-		err = pAcceptor->bind(addr,addr_len,defaults);
+		err = pAcceptor->bind(addr,addr_len,defaults,options);
 		if (err != 0)
 		{
 			OOBase::CrtAllocator::delete_free(pAcceptor);
@@ -1127,13 +1476,24 @@ OOBase::Acceptor* OOBase::detail::ProactorPosix::accept(void* param, accept_pipe
 	return pAcceptor;
 }
 
-OOBase::AsyncSocket* OOBase::detail::ProactorPosix::connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout)
+OOBase::AsyncSocket* OOBase::detail::ProactorPosix::connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout, const SocketOptions* options)
 {
 	int fd = Net::open_socket(addr->sa_family,SOCK_STREAM,0,err);
 	if (err)
 		return NULL;
 
-	if ((err = Net::connect(fd,addr,addr_len,timeout)) != 0)
+	// Buffer sizes must be set before the SYN, so the window scale matches them
+	if (options && (options->m_sndbuf || options->m_rcvbuf))
+	{
+		SocketOptions buffers;
+		memset(&buffers,0,sizeof(buffers));
+		buffers.m_sndbuf = options->m_sndbuf;
+		buffers.m_rcvbuf = options->m_rcvbuf;
+
+		err = Net::set_options(fd,buffers);
+	}
+
+	if (err || (err = Net::connect(fd,addr,addr_len,timeout)) != 0)
 	{
 		Net::close_socket(fd);
 		return NULL;
@@ -1142,6 +1502,11 @@ OOBase::AsyncSocket* OOBase::detail::ProactorPosix::connect(const sockaddr* addr
 	AsyncSocket* pSocket = attach(fd,err);
 	if (!pSocket)
 		Net::close_socket(fd);
+	else if (options && (err = pSocket->set_options(*options)) != 0)
+	{
+		pSocket->release();
+		pSocket = NULL;
+	}
 
 	return pSocket;
 }
@@ -0,0 +1,203 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+#include "../include/OOBase/Posix.h"
+
+#include "ProactorPosix.h"
+
+#if defined(HAVE_UNISTD_H)
+
+namespace
+{
+	class PosixFdWatcher : public OOBase::FdWatcher
+	{
+	public:
+		PosixFdWatcher(OOBase::detail::ProactorPosix* pProactor, int fd, void* param, OOBase::Proactor::watch_callback_t callback, Mode mode);
+		virtual ~PosixFdWatcher();
+
+		int init(unsigned int events);
+
+		int rearm(unsigned int events);
+
+	private:
+		OOBase::detail::ProactorPosix*     m_pProactor;
+		int                                m_fd;
+		void*                              m_param;
+		OOBase::Proactor::watch_callback_t m_callback;
+		Mode                               m_mode;
+		bool                               m_bound;
+
+		// Guards the members below, so release() can be called during a callback.
+		// A Mutex, as watch_fd() can block on the Proactor while it is held
+		OOBase::Mutex                      m_lock;
+		unsigned int                       m_events;
+		bool                               m_in_callback;
+		bool                               m_destroyed;
+
+		static unsigned int tx_events(unsigned int events);
+		static void fd_callback(int fd, void* param, unsigned int events);
+
+		virtual void destroy();
+	};
+}
+
+PosixFdWatcher::PosixFdWatcher(OOBase::detail::ProactorPosix* pProactor, int fd, void* param, OOBase::Proactor::watch_callback_t callback, Mode mode) :
+		m_pProactor(pProactor),
+		m_fd(fd),
+		m_param(param),
+		m_callback(callback),
+		m_mode(mode),
+		m_bound(false),
+		m_events(0),
+		m_in_callback(false),
+		m_destroyed(false)
+{ }
+
+PosixFdWatcher::~PosixFdWatcher()
+{
+	if (m_bound)
+		m_pProactor->unbind_fd(m_fd);
+}
+
+void PosixFdWatcher::destroy()
+{
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	// fd_callback() deletes us when the callback returns
+	if (m_in_callback)
+	{
+		m_destroyed = true;
+		return;
+	}
+
+	guard.release();
+
+	OOBase::CrtAllocator::delete_free(this);
+}
+
+unsigned int PosixFdWatcher::tx_events(unsigned int events)
+{
+	unsigned int tx = 0;
+	if (events & eRead)
+		tx |= OOBase::detail::eTXRecv;
+	if (events & eWrite)
+		tx |= OOBase::detail::eTXSend;
+	return tx;
+}
+
+int PosixFdWatcher::init(unsigned int events)
+{
+	int err = m_pProactor->bind_fd(m_fd,this,&fd_callback);
+	if (err)
+		return err;
+
+	m_bound = true;
+
+	return rearm(events);
+}
+
+int PosixFdWatcher::rearm(unsigned int events)
+{
+	OOBase::Guard<OOBase::Mutex> guard(m_lock);
+
+	m_events = events;
+
+	// A persistent watcher re-arms itself once the callback returns
+	if (!events || (m_in_callback && m_mode == ePersistent))
+		return 0;
+
+	return m_pProactor->watch_fd(m_fd,tx_events(events));
+}
+
+void PosixFdWatcher::fd_callback(int fd, void* param, unsigned int events)
+{
+	PosixFdWatcher* pThis = static_cast<PosixFdWatcher*>(param);
+	if (pThis->m_fd != fd)
+		OOBase_CallCriticalFailure("Wrong fd passed to callback");
+
+	OOBase::Guard<OOBase::Mutex> guard(pThis->m_lock);
+	pThis->m_in_callback = true;
+	guard.release();
+
+	unsigned int ready = 0;
+	if (events & OOBase::detail::eTXRecv)
+		ready |= eRead;
+	if (events & OOBase::detail::eTXSend)
+		ready |= eWrite;
+
+	(*pThis->m_callback)(pThis->m_param,fd,ready,0);
+
+	for (;;)
+	{
+		guard.acquire();
+
+		pThis->m_in_callback = false;
+		if (pThis->m_destroyed)
+		{
+			guard.release();
+			OOBase::CrtAllocator::delete_free(pThis);
+			return;
+		}
+
+		if (pThis->m_mode != ePersistent || !pThis->m_events)
+			return;
+
+		// Re-arm with the lock held, so a concurrent release() waits for us
+		int err = pThis->m_pProactor->watch_fd(fd,tx_events(pThis->m_events));
+		if (!err)
+			return;
+
+		// Report the failure, and stop watching unless the callback re-arms
+		pThis->m_events = 0;
+		pThis->m_in_callback = true;
+		guard.release();
+
+		(*pThis->m_callback)(pThis->m_param,fd,0,err);
+	}
+}
+
+OOBase::FdWatcher* OOBase::detail::ProactorPosix::watch(void* param, watch_callback_t callback, int fd, unsigned int events, FdWatcher::Mode mode, int& err)
+{
+	if (!callback || fd == -1)
+	{
+		err = EINVAL;
+		return NULL;
+	}
+
+	PosixFdWatcher* pWatcher = NULL;
+	if (!OOBase::CrtAllocator::allocate_new(pWatcher,this,fd,param,callback,mode))
+	{
+		err = ERROR_OUTOFMEMORY;
+		return NULL;
+	}
+
+	err = pWatcher->init(events);
+	if (err)
+	{
+		pWatcher->release();
+		pWatcher = NULL;
+	}
+
+	return pWatcher;
+}
+
+#endif // defined(HAVE_UNISTD_H)
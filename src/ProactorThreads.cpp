@@ -0,0 +1,275 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2013 Rick Taylor
+//
+// This file is part of OOBase, the Omega Online Base library.
+//
+// OOBase is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOBase is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOBase.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+
+// CPU_SET() and friends are GNU extensions
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "../include/OOBase/ProactorThreads.h"
+#include "../include/OOBase/Posix.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <stdio.h>
+#endif
+
+#include <string.h>
+
+OOBase::ProactorThreads::ProactorThreads(Proactor* proactor) :
+		m_proactor(proactor),
+		m_affinity(eAffinityNone),
+		m_ids(NULL),
+		m_id_count(0),
+		m_threads(0),
+		m_next(0),
+		m_err(0)
+{
+}
+
+OOBase::ProactorThreads::~ProactorThreads()
+{
+	stop();
+
+	CrtAllocator::free(m_ids);
+}
+
+size_t OOBase::ProactorThreads::cpu_count()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO si = {0};
+	::GetSystemInfo(&si);
+	return si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0 ? static_cast<size_t>(n) : 1);
+#else
+	return 1;
+#endif
+}
+
+int OOBase::ProactorThreads::set_affinity(Affinity affinity, const unsigned int* ids, size_t count)
+{
+	if (m_threads)
+		return EBUSY;
+
+	if (affinity != eAffinityNone && (!ids || !count))
+		return EINVAL;
+
+#if !defined(_WIN32) && !defined(__linux__)
+	if (affinity != eAffinityNone)
+		return ENOTSUP;
+#endif
+
+	unsigned int* new_ids = NULL;
+	if (affinity != eAffinityNone)
+	{
+		new_ids = static_cast<unsigned int*>(CrtAllocator::allocate(count * sizeof(unsigned int),alignment_of<unsigned int>::value));
+		if (!new_ids)
+			return ERROR_OUTOFMEMORY;
+
+		memcpy(new_ids,ids,count * sizeof(unsigned int));
+	}
+	else
+		count = 0;
+
+	CrtAllocator::free(m_ids);
+	m_ids = new_ids;
+	m_id_count = count;
+	m_affinity = affinity;
+	return 0;
+}
+
+int OOBase::ProactorThreads::start(size_t threads)
+{
+	if (m_threads)
+		return EBUSY;
+
+	if (!threads)
+		threads = cpu_count();
+
+	// A previous stop(), or a failed start(), leaves the Proactor stopped
+	int err = m_proactor->restart();
+	if (err)
+		return err;
+
+	m_next = 0;
+	m_err = 0;
+	m_threads = threads;
+
+	err = m_pool.run(&run,this,threads);
+	if (err)
+	{
+		m_proactor->stop();
+		m_pool.join();
+		m_threads = 0;
+	}
+	return err;
+}
+
+int OOBase::ProactorThreads::stop()
+{
+	if (!m_threads)
+		return 0;
+
+	m_proactor->stop();
+	m_pool.join();
+	m_threads = 0;
+
+	return m_err;
+}
+
+int OOBase::ProactorThreads::run(void* param)
+{
+	ProactorThreads* pThis = static_cast<ProactorThreads*>(param);
+
+	Guard<SpinLock> guard(pThis->m_lock);
+	size_t index = pThis->m_next++;
+	guard.release();
+
+	int err = 0;
+	if (pThis->m_id_count)
+		err = pThis->pin(pThis->m_ids[index % pThis->m_id_count]);
+
+	if (!err)
+		pThis->m_proactor->run(err);
+
+	if (err)
+	{
+		// Keep the first error
+		guard.acquire();
+		if (!pThis->m_err)
+			pThis->m_err = err;
+	}
+
+	return err;
+}
+
+#if defined(_WIN32)
+
+int OOBase::ProactorThreads::pin(unsigned int id)
+{
+	DWORD_PTR mask = 0;
+	if (m_affinity == eAffinityCPU)
+	{
+		if (id >= sizeof(DWORD_PTR) * 8)
+			return ERROR_INVALID_PARAMETER;
+
+		mask = DWORD_PTR(1) << id;
+	}
+	else
+	{
+		ULONGLONG node_mask = 0;
+		if (id > 0xFF || !::GetNumaNodeProcessorMask(static_cast<UCHAR>(id),&node_mask))
+			return ERROR_INVALID_PARAMETER;
+
+		mask = static_cast<DWORD_PTR>(node_mask);
+	}
+
+	if (!mask || !::SetThreadAffinityMask(::GetCurrentThread(),mask))
+		return ::GetLastError() ? ::GetLastError() : ERROR_INVALID_PARAMETER;
+
+	return 0;
+}
+
+#elif defined(__linux__)
+
+namespace
+{
+	// Parses a sysfs cpulist such as "0-7,16-23"
+	int node_cpus(unsigned int node, cpu_set_t& set)
+	{
+		char path[64] = {0};
+		snprintf(path,sizeof(path),"/sys/devices/system/node/node%u/cpulist",node);
+
+		FILE* f = fopen(path,"r");
+		if (!f)
+			return errno;
+
+		char list[1024] = {0};
+		bool ok = (fgets(list,sizeof(list),f) != NULL);
+		fclose(f);
+		if (!ok)
+			return EINVAL;
+
+		for (const char* p = list; *p && *p != '\n';)
+		{
+			char* end = NULL;
+			unsigned long first = strtoul(p,&end,10);
+			if (end == p)
+				return EINVAL;
+
+			unsigned long last = first;
+			if (*end == '-')
+			{
+				p = end + 1;
+				last = strtoul(p,&end,10);
+				if (end == p)
+					return EINVAL;
+			}
+
+			for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+				CPU_SET(cpu,&set);
+
+			p = (*end == ',' ? end + 1 : end);
+		}
+
+		return 0;
+	}
+}
+
+int OOBase::ProactorThreads::pin(unsigned int id)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	if (m_affinity == eAffinityCPU)
+	{
+		if (id >= CPU_SETSIZE)
+			return EINVAL;
+
+		CPU_SET(id,&set);
+	}
+	else
+	{
+		int err = node_cpus(id,set);
+		if (err)
+			return err;
+	}
+
+	if (!CPU_COUNT(&set))
+		return EINVAL;
+
+	if (::sched_setaffinity(0,sizeof(set),&set) != 0)
+		return errno;
+
+	return 0;
+}
+
+#else
+
+int OOBase::ProactorThreads::pin(unsigned int)
+{
+	return ENOTSUP;
+}
+
+#endif
@@ -180,6 +180,96 @@ int OOBase::detail::ProactorWin32::restart()
 	return bind(INVALID_HANDLE_VALUE);
 }
 
+int OOBase::detail::ProactorWin32::enable_stats(bool)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int OOBase::detail::ProactorWin32::get_stats(ProactorStats&, bool)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int OOBase::detail::ProactorWin32::set_busy_poll(unsigned int, bool)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int OOBase::detail::ProactorWin32::set_recv_budget(size_t, size_t)
+{
+	// Each completion is a single WSARecv already, so sockets take turns anyway
+	return 0;
+}
+
+int OOBase::detail::ProactorWin32::post(void* param, post_callback_t callback)
+{
+	// The completion port is already a lock-free queue
+	Overlapped* pOv = NULL;
+	int err = new_overlapped(pOv,&on_post);
+	if (err)
+		return err;
+
+	pOv->m_extras[0] = reinterpret_cast<ULONG_PTR>(param);
+	pOv->m_extras[1] = reinterpret_cast<ULONG_PTR>(callback);
+
+	err = post_completion(0,0,pOv);
+	if (err)
+		delete_overlapped(pOv);
+
+	return err;
+}
+
+OOBase::FdWatcher* OOBase::detail::ProactorWin32::watch(void*, watch_callback_t, int, unsigned int, FdWatcher::Mode, int& err)
+{
+	// Use wait_for_object() for HANDLEs
+	err = ERROR_NOT_SUPPORTED;
+	return NULL;
+}
+
+int OOBase::detail::ProactorWin32::start_timer(void*, timer_callback_t, const Timeout&)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int OOBase::detail::ProactorWin32::stop_timer(void*)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+void OOBase::detail::ProactorWin32::on_post(HANDLE, DWORD, DWORD, Overlapped* pOv)
+{
+	void* param = reinterpret_cast<void*>(pOv->m_extras[0]);
+	post_callback_t callback = reinterpret_cast<post_callback_t>(pOv->m_extras[1]);
+
+	pOv->m_pProactor->delete_overlapped(pOv);
+
+	(*callback)(param);
+}
+
+OOBase::Acceptor* OOBase::detail::ProactorWin32::accept_shared(void*, accept_pipe_callback_t, const char*, int& err, SECURITY_ATTRIBUTES*)
+{
+	err = ERROR_NOT_SUPPORTED;
+	return NULL;
+}
+
+OOBase::AsyncSocket* OOBase::detail::ProactorWin32::connect_shared(const char*, int& err, const Timeout&, size_t)
+{
+	err = ERROR_NOT_SUPPORTED;
+	return NULL;
+}
+
+OOBase::AsyncDatagramSocket* OOBase::detail::ProactorWin32::open_datagram(const sockaddr*, socklen_t, int& err)
+{
+	err = ERROR_NOT_SUPPORTED;
+	return NULL;
+}
+
+OOBase::AsyncDatagramSocket* OOBase::detail::ProactorWin32::attach_datagram(socket_t, int& err)
+{
+	err = ERROR_NOT_SUPPORTED;
+	return NULL;
+}
+
 namespace
 {
 	class InternalWaitAcceptor : public OOBase::RefCounted
@@ -41,15 +41,21 @@ namespace OOBase
 		// Proactor public members
 		public:
 			Acceptor* accept(void* param, accept_pipe_callback_t callback, const char* path, int& err, SECURITY_ATTRIBUTES* psa);
-			Acceptor* accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err);
+			Acceptor* accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err, const SocketOptions* options);
 			Acceptor* accept_unique_pipe(void* param, accept_pipe_callback_t callback, /*(out)*/ char path[64], int& err, SECURITY_ATTRIBUTES* psa);
 
 			AsyncSocket* attach(socket_t sock, int& err);
 			AsyncSocket* attach(HANDLE hPipe, int& err);
 
-			AsyncSocket* connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout);
+			AsyncSocket* connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout, const SocketOptions* options);
 			AsyncSocket* connect(const char* path, int& err, const Timeout& timeout);
 
+			AsyncDatagramSocket* open_datagram(const sockaddr* addr, socklen_t addr_len, int& err);
+			AsyncDatagramSocket* attach_datagram(socket_t sock, int& err);
+
+			Acceptor* accept_shared(void* param, accept_pipe_callback_t callback, const char* path, int& err, SECURITY_ATTRIBUTES* psa);
+			AsyncSocket* connect_shared(const char* path, int& err, const Timeout& timeout, size_t ring_size);
+
 			Acceptor* wait_for_object(void* param, wait_object_callback_t callback, HANDLE hObject, int& err, ULONG dwMilliseconds);
 
 			// 'Internal' public members
@@ -59,6 +65,15 @@ namespace OOBase
 
 			void stop();
 			int restart();
+
+			int enable_stats(bool enable);
+			int get_stats(ProactorStats& stats, bool reset);
+			int set_busy_poll(unsigned int spin_usecs, bool socket_busy_poll);
+			int set_recv_budget(size_t bytes, size_t ops);
+			int post(void* param, post_callback_t callback);
+			FdWatcher* watch(void* param, watch_callback_t callback, int fd, unsigned int events, FdWatcher::Mode mode, int& err);
+			int start_timer(void* param, timer_callback_t callback, const Timeout& timeout);
+			int stop_timer(void* param);
 		
 			struct Overlapped : public OVERLAPPED
 			{
@@ -85,6 +100,8 @@ namespace OOBase
 			}
 
 		private:
+			static void on_post(HANDLE handle, DWORD dwBytes, DWORD dwErr, Overlapped* pOv);
+
 			HANDLE   m_hPort;
 			SpinLock m_lock;
 			size_t   m_bound;
@@ -44,6 +44,10 @@ namespace
 		int send_msg(void* param, send_msg_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& data_buffer, const OOBase::RefPtr<OOBase::Buffer>& ctl_buffer);
 		int shutdown(bool bSend, bool bRecv);
 		OOBase::socket_t get_handle() const;
+		int enable_stats(bool enable);
+		int get_stats(OOBase::AsyncSocketStats& stats);
+		int set_options(const OOBase::SocketOptions& options);
+		int set_watermarks(size_t high, size_t low, void* param, watermark_callback_t callback);
 
 	protected:
 		OOBase::AllocatorInstance& get_internal_allocator() const
@@ -409,6 +413,26 @@ OOBase::socket_t AsyncPipe::get_handle() const
 	return (OOBase::socket_t)(HANDLE)m_hPipe;
 }
 
+int AsyncPipe::enable_stats(bool)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int AsyncPipe::get_stats(OOBase::AsyncSocketStats&)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int AsyncPipe::set_options(const OOBase::SocketOptions&)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int AsyncPipe::set_watermarks(size_t, size_t, void*, watermark_callback_t)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
 namespace
 {
 	class InternalAcceptor
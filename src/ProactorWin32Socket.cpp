@@ -45,6 +45,10 @@ namespace
 		int send_msg(void* param, send_msg_callback_t callback, const OOBase::RefPtr<OOBase::Buffer>& data_buffer, const OOBase::RefPtr<OOBase::Buffer>& ctl_buffer);
 		int shutdown(bool bSend, bool bRecv);
 		OOBase::socket_t get_handle() const;
+		int enable_stats(bool enable);
+		int get_stats(OOBase::AsyncSocketStats& stats);
+		int set_options(const OOBase::SocketOptions& options);
+		int set_watermarks(size_t high, size_t low, void* param, watermark_callback_t callback);
 
 	protected:
 		OOBase::AllocatorInstance& get_internal_allocator() const
@@ -522,12 +526,36 @@ OOBase::socket_t Win32AsyncSocket::get_handle() const
 	return m_hSocket;
 }
 
+int Win32AsyncSocket::enable_stats(bool)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int Win32AsyncSocket::get_stats(OOBase::AsyncSocketStats&)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
+int Win32AsyncSocket::set_options(const OOBase::SocketOptions& options)
+{
+	// Corking is left to the AsyncSocket, and this one does not cork
+	if (options.m_cork == OOBase::SocketOptions::eOn)
+		return ERROR_NOT_SUPPORTED;
+
+	return OOBase::Net::set_options(m_hSocket,options);
+}
+
+int Win32AsyncSocket::set_watermarks(size_t, size_t, void*, watermark_callback_t)
+{
+	return ERROR_NOT_SUPPORTED;
+}
+
 namespace
 {
 	class InternalAcceptor
 	{
 	public:
-		InternalAcceptor(OOBase::detail::ProactorWin32* pProactor, void* param, OOBase::Proactor::accept_callback_t callback);
+		InternalAcceptor(OOBase::detail::ProactorWin32* pProactor, void* param, OOBase::Proactor::accept_callback_t callback, const OOBase::SocketOptions* options);
 		
 		int listen(size_t backlog);
 		int stop(bool destroy);
@@ -547,6 +575,8 @@ namespace
 		HANDLE                                           m_hWait;
 		void*                                            m_param;
 		OOBase::Proactor::accept_callback_t              m_callback;
+		OOBase::SocketOptions                            m_options;
+		bool                                             m_has_options;
 
 		static void on_completion(HANDLE hSocket, DWORD dwBytes, DWORD dwErr, OOBase::detail::ProactorWin32::Overlapped* pOv);
 		static void CALLBACK accept_ready(PVOID lpParameter, BOOLEAN TimerOrWaitFired);
@@ -564,7 +594,7 @@ namespace
 		
 		int listen(size_t backlog);
 		int stop();
-		int bind(OOBase::detail::ProactorWin32* pProactor, void* param, OOBase::Proactor::accept_callback_t callback, const sockaddr* addr, socklen_t addr_len);
+		int bind(OOBase::detail::ProactorWin32* pProactor, void* param, OOBase::Proactor::accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, const OOBase::SocketOptions* options);
 	
 	private:
 		InternalAcceptor* m_pAcceptor;
@@ -597,9 +627,9 @@ int SocketAcceptor::stop()
 	return m_pAcceptor->stop(false);
 }
 
-int SocketAcceptor::bind(OOBase::detail::ProactorWin32* pProactor, void* param, OOBase::Proactor::accept_callback_t callback, const sockaddr* addr, socklen_t addr_len)
+int SocketAcceptor::bind(OOBase::detail::ProactorWin32* pProactor, void* param, OOBase::Proactor::accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, const OOBase::SocketOptions* options)
 {
-	if (!OOBase::CrtAllocator::allocate_new(m_pAcceptor,pProactor,param,callback))
+	if (!OOBase::CrtAllocator::allocate_new(m_pAcceptor,pProactor,param,callback,options))
 		return ERROR_OUTOFMEMORY;
 
 	int err = m_pAcceptor->bind(addr,addr_len);
@@ -612,7 +642,7 @@ int SocketAcceptor::bind(OOBase::detail::ProactorWin32* pProactor, void* param,
 	return err;
 }
 
-InternalAcceptor::InternalAcceptor(OOBase::detail::ProactorWin32* pProactor, void* param, OOBase::Proactor::accept_callback_t callback) :
+InternalAcceptor::InternalAcceptor(OOBase::detail::ProactorWin32* pProactor, void* param, OOBase::Proactor::accept_callback_t callback, const OOBase::SocketOptions* options) :
 		m_pProactor(pProactor),
 		m_addr_len(0),
 		m_socket(INVALID_SOCKET),
@@ -621,8 +651,12 @@ InternalAcceptor::InternalAcceptor(OOBase::detail::ProactorWin32* pProactor, voi
 		m_refcount(1),
 		m_hWait(NULL),
 		m_param(param),
-		m_callback(callback)
-{ }
+		m_callback(callback),
+		m_has_options(options != NULL)
+{
+	if (options)
+		m_options = *options;
+}
 
 int InternalAcceptor::bind(const sockaddr* addr, socklen_t addr_len)
 {
@@ -707,6 +741,18 @@ int InternalAcceptor::init_accept(OOBase::Guard<OOBase::Condition::Mutex>& guard
 	if (err)
 		return err;
 		
+	// Set the buffer sizes before listen, so window scaling sees them, this also fails early on unsupported options
+	if (m_has_options)
+	{
+		err = OOBase::Net::set_options(m_socket,m_options);
+		if (err != 0)
+		{
+			OOBase::Net::close_socket(m_socket);
+			m_socket = INVALID_SOCKET;
+			return err;
+		}
+	}
+
 	// Bind to the address
 	if (::bind(m_socket,(struct sockaddr*)&m_addr,m_addr_len) == SOCKET_ERROR)
 		err = WSAGetLastError();
@@ -721,8 +767,9 @@ int InternalAcceptor::init_accept(OOBase::Guard<OOBase::Condition::Mutex>& guard
 				err = WSAGetLastError();
 			else
 			{
-				// Start the socket listening...
-				if (::listen(m_socket,static_cast<int>(m_backlog)) == SOCKET_ERROR)
+				// Start the socket listening, m_backlog is the number of AcceptEx calls kept pending
+				int backlog = (m_has_options && m_options.m_backlog ? m_options.m_backlog : static_cast<int>(m_backlog));
+				if (::listen(m_socket,backlog) == SOCKET_ERROR)
 					err = WSAGetLastError();
 				else
 				{
@@ -884,11 +931,18 @@ bool InternalAcceptor::on_accept(SOCKET hSocket, bool bRemove, DWORD dwErr, void
 		sockaddr* local_addr = NULL;
 		INT local_addr_len = 0;
 		OOBase::Win32::WSAGetAcceptExSockAddrs(m_socket,addr_buf,0,m_addr_len+16,m_addr_len+16,&local_addr,&local_addr_len,&remote_addr,&remote_addr_len);
-			
-		// Wrap the handle
-		pSocket = new Win32AsyncSocket(m_pProactor,hSocket);
-		if (!pSocket)
-			dwErr = ERROR_OUTOFMEMORY;
+		
+		// Apply the options before the callback sees the socket
+		if (m_has_options)
+			dwErr = OOBase::Net::set_options(hSocket,m_options);
+
+		if (dwErr == 0)
+		{
+			// Wrap the handle
+			pSocket = new Win32AsyncSocket(m_pProactor,hSocket);
+			if (!pSocket)
+				dwErr = ERROR_OUTOFMEMORY;
+		}
 	}
 	
 	if (dwErr != 0)
@@ -938,7 +992,7 @@ bool InternalAcceptor::on_accept(SOCKET hSocket, bool bRemove, DWORD dwErr, void
 	return false;
 }
 
-OOBase::Acceptor* OOBase::detail::ProactorWin32::accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err)
+OOBase::Acceptor* OOBase::detail::ProactorWin32::accept(void* param, accept_callback_t callback, const sockaddr* addr, socklen_t addr_len, int& err, const SocketOptions* options)
 {
 	Win32::WSAStartup();
 	
@@ -948,13 +1002,20 @@ OOBase::Acceptor* OOBase::detail::ProactorWin32::accept(void* param, accept_call
 		err = ERROR_INVALID_PARAMETER;
 		return NULL;
 	}
+
+	// Accepted Win32 sockets never cork
+	if (options && options->m_cork == SocketOptions::eOn)
+	{
+		err = ERROR_NOT_SUPPORTED;
+		return NULL;
+	}
 	
 	SocketAcceptor* pAcceptor = new SocketAcceptor();
 	if (!pAcceptor)
 		err = ERROR_OUTOFMEMORY;
 	else
 	{
-		err = pAcceptor->bind(this,param,callback,addr,addr_len);
+		err = pAcceptor->bind(this,param,callback,addr,addr_len,options);
 		if (err != 0)
 		{
 			pAcceptor->release();
@@ -965,11 +1026,17 @@ OOBase::Acceptor* OOBase::detail::ProactorWin32::accept(void* param, accept_call
 	return pAcceptor;
 }
 
-OOBase::AsyncSocket* OOBase::detail::ProactorWin32::connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout)
+OOBase::AsyncSocket* OOBase::detail::ProactorWin32::connect(const sockaddr* addr, socklen_t addr_len, int& err, const Timeout& timeout, const SocketOptions* options)
 {
 	SOCKET sock = Net::open_socket(addr->sa_family,SOCK_STREAM,0,err);
 	if (err)
 		return NULL;
+
+	if (options && (err = Net::set_options(sock,*options)) != 0)
+	{
+		Net::close_socket(sock);
+		return NULL;
+	}
 	
 	if ((err = Net::connect(sock,addr,addr_len,timeout)) != 0)
 	{
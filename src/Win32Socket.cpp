@@ -326,6 +326,47 @@ int OOBase::Net::bind(socket_t sock, const sockaddr* addr, socklen_t addr_len)
 	return (::bind(sock,addr,addr_len) != 0 ? WSAGetLastError() : 0);
 }
 
+namespace
+{
+	int set_int_option(SOCKET sock, int level, int name, int val)
+	{
+		return (::setsockopt(sock,level,name,reinterpret_cast<const char*>(&val),sizeof(val)) == SOCKET_ERROR ? WSAGetLastError() : 0);
+	}
+
+	int set_switch_option(SOCKET sock, int level, int name, OOBase::SocketOptions::Switch val)
+	{
+		return (val == OOBase::SocketOptions::eDefault ? 0 : set_int_option(sock,level,name,val == OOBase::SocketOptions::eOn ? 1 : 0));
+	}
+}
+
+int OOBase::Net::set_options(socket_t sock, const SocketOptions& options)
+{
+	int err = set_switch_option(sock,IPPROTO_TCP,TCP_NODELAY,options.m_nodelay);
+	if (!err)
+		err = set_switch_option(sock,SOL_SOCKET,SO_KEEPALIVE,options.m_keepalive);
+	if (!err && options.m_sndbuf)
+		err = set_int_option(sock,SOL_SOCKET,SO_SNDBUF,options.m_sndbuf);
+	if (!err && options.m_rcvbuf)
+		err = set_int_option(sock,SOL_SOCKET,SO_RCVBUF,options.m_rcvbuf);
+
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+	if (!err && options.m_keepalive_idle)
+		err = set_int_option(sock,IPPROTO_TCP,TCP_KEEPIDLE,options.m_keepalive_idle);
+	if (!err && options.m_keepalive_interval)
+		err = set_int_option(sock,IPPROTO_TCP,TCP_KEEPINTVL,options.m_keepalive_interval);
+	if (!err && options.m_keepalive_count)
+		err = set_int_option(sock,IPPROTO_TCP,TCP_KEEPCNT,options.m_keepalive_count);
+#else
+	if (!err && (options.m_keepalive_idle || options.m_keepalive_interval || options.m_keepalive_count))
+		err = ERROR_NOT_SUPPORTED;
+#endif
+
+	if (!err && (options.m_quickack == SocketOptions::eOn || options.m_notsent_lowat))
+		err = ERROR_NOT_SUPPORTED;
+
+	return err;
+}
+
 namespace
 {
 	class WinSocket : public OOBase::Socket